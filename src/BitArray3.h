@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "Coords3.h"
+#include "Size3.h"
+#include "Util.h"
+
+// packed array of bits
+// stored in 'depth-major' order, each (x, y) owns whole words
+// ie. A[x][y][0..depth-1] occupies A[{x, y}][0..numWordsPerCell()-1]
+// bits past depth in the last word of a cell are always 0
+// when WordsPerCellV is not 0 the number of words per cell is a compile time constant
+// and depth must not exceed WordsPerCellV * bitsPerWord
+template <int WordsPerCellV = 0>
+struct BitArray3
+{
+    using WordType = std::uint64_t;
+
+    static constexpr int bitsPerWord = 64;
+
+    static constexpr bool hasFixedNumWordsPerCell = WordsPerCellV != 0;
+
+    BitArray3() :
+        m_size(0, 0, 0),
+        m_numWordsPerCell(0),
+        m_words(nullptr)
+    {
+
+    }
+
+    BitArray3(Size3i size, bool value = false) :
+        m_size(size),
+        m_numWordsPerCell(hasFixedNumWordsPerCell ? WordsPerCellV : numWordsFor(size.depth)),
+        m_words(new WordType[numWordsTotal()])
+    {
+        assert(numWordsFor(size.depth) <= m_numWordsPerCell);
+
+        fill(value);
+    }
+
+    BitArray3(const BitArray3& other) :
+        m_size(other.m_size),
+        m_numWordsPerCell(other.m_numWordsPerCell),
+        m_words(new WordType[other.numWordsTotal()])
+    {
+        std::copy(other.wordsBegin(), other.wordsEnd(), wordsBegin());
+    }
+
+    BitArray3(BitArray3&& other) noexcept :
+        m_size(other.m_size),
+        m_numWordsPerCell(other.m_numWordsPerCell),
+        m_words(std::move(other.m_words))
+    {
+    }
+
+    BitArray3& operator=(const BitArray3& other)
+    {
+        m_size = other.m_size;
+        m_numWordsPerCell = other.m_numWordsPerCell;
+        m_words.reset(new WordType[numWordsTotal()]);
+        std::copy(other.wordsBegin(), other.wordsEnd(), wordsBegin());
+        return *this;
+    }
+
+    BitArray3& operator=(BitArray3&& other) noexcept
+    {
+        m_size = other.m_size;
+        m_numWordsPerCell = other.m_numWordsPerCell;
+        m_words = std::move(other.m_words);
+        return *this;
+    }
+
+    [[nodiscard]] static constexpr int numWordsFor(int numBits)
+    {
+        return (numBits + bitsPerWord - 1) / bitsPerWord;
+    }
+
+    [[nodiscard]] static constexpr WordType bitMask(int bitIndex)
+    {
+        return WordType(1) << (bitIndex % bitsPerWord);
+    }
+
+    void fill(bool v)
+    {
+        std::fill(wordsBegin(), wordsEnd(), v ? ~WordType(0) : WordType(0));
+
+        if (v)
+        {
+            // keep the padding bits cleared so that counting doesn't have to mask them
+            const int numWords = numWordsPerCell();
+            for (int i = 0; i < numWords; ++i)
+            {
+                const int numBits = std::clamp(m_size.depth - i * bitsPerWord, 0, bitsPerWord);
+                if (numBits == bitsPerWord)
+                {
+                    continue;
+                }
+
+                const WordType mask = (WordType(1) << numBits) - 1;
+                for (int j = i; j < numWordsTotal(); j += numWords)
+                {
+                    m_words[j] = mask;
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] bool operator[](Coords3i coords) const
+    {
+        return ((*this)[Coords2i(coords.x, coords.y)][coords.z / bitsPerWord] & bitMask(coords.z)) != 0;
+    }
+
+    [[nodiscard]] WordType* operator[](Coords2i coords)
+    {
+        return m_words.get() + getFlatCellIndex(coords) * numWordsPerCell();
+    }
+
+    [[nodiscard]] const WordType* operator[](Coords2i coords) const
+    {
+        return m_words.get() + getFlatCellIndex(coords) * numWordsPerCell();
+    }
+
+    void set(Coords3i coords)
+    {
+        (*this)[Coords2i(coords.x, coords.y)][coords.z / bitsPerWord] |= bitMask(coords.z);
+    }
+
+    void reset(Coords3i coords)
+    {
+        (*this)[Coords2i(coords.x, coords.y)][coords.z / bitsPerWord] &= ~bitMask(coords.z);
+    }
+
+    // number of set bits for the given (x, y)
+    [[nodiscard]] int count(Coords2i coords) const
+    {
+        const WordType* words = (*this)[coords];
+        int c = 0;
+        for (int i = 0; i < numWordsPerCell(); ++i)
+        {
+            c += util::popcount(words[i]);
+        }
+        return c;
+    }
+
+    // lowest z for which the bit at (x, y, z) is set, -1 if there's none
+    [[nodiscard]] int findFirstSet(Coords2i coords) const
+    {
+        const WordType* words = (*this)[coords];
+        for (int i = 0; i < numWordsPerCell(); ++i)
+        {
+            if (words[i])
+            {
+                return i * bitsPerWord + util::findFirstSet(words[i]);
+            }
+        }
+        return -1;
+    }
+
+    // calls func(z) for every set bit at (x, y), in ascending order of z
+    template <typename FuncT>
+    void forEachSetBit(Coords2i coords, FuncT&& func) const
+    {
+        const WordType* words = (*this)[coords];
+        for (int i = 0; i < numWordsPerCell(); ++i)
+        {
+            const int base = i * bitsPerWord;
+            util::forEachSetBit(words[i], [&func, base](int bit) { func(base + bit); });
+        }
+    }
+
+    [[nodiscard]] int getFlatCellIndex(Coords2i coords) const
+    {
+        return coords.x * m_size.height + coords.y;
+    }
+
+    [[nodiscard]] int numWordsPerCell() const
+    {
+        if constexpr (hasFixedNumWordsPerCell)
+        {
+            return WordsPerCellV;
+        }
+        else
+        {
+            return m_numWordsPerCell;
+        }
+    }
+
+    [[nodiscard]] int numWordsTotal() const
+    {
+        return m_size.width * m_size.height * numWordsPerCell();
+    }
+
+    [[nodiscard]] WordType* wordsBegin()
+    {
+        return m_words.get();
+    }
+
+    [[nodiscard]] const WordType* wordsBegin() const
+    {
+        return m_words.get();
+    }
+
+    [[nodiscard]] WordType* wordsEnd()
+    {
+        return m_words.get() + numWordsTotal();
+    }
+
+    [[nodiscard]] const WordType* wordsEnd() const
+    {
+        return m_words.get() + numWordsTotal();
+    }
+
+    [[nodiscard]] Size3i size() const
+    {
+        return m_size;
+    }
+
+private:
+    Size3i m_size;
+    int m_numWordsPerCell;
+    std::unique_ptr<WordType[]> m_words;
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "Array2.h"
+#include "Coords2.h"
+#include "Logger.h"
+#include "Model.h"
+#include "Size2.h"
+#include "Util.h"
+
+struct ChunkedWorldOptions
+{
+    using SeedType = std::uint64_t;
+
+    static constexpr Size2i defaultChunkSize = { 32, 32 };
+    static constexpr int defaultMaxCachedChunks = 256;
+    static constexpr int defaultMaxChunkTries = 10;
+    static constexpr int defaultMarginWidth = 2;
+
+    // in wave cells
+    Size2i chunkSize;
+
+    // how far around the chunk the generation looks, at least 1 and at most the chunk size
+    // cells of already generated neighbours are pinned there, the rest only has to be completable
+    int marginWidth;
+
+    int maxCachedChunks;
+    int maxChunkTries;
+    SeedType seed;
+
+    // when not empty chunks evicted from the cache are saved there
+    // and loaded back instead of being generated again.
+    // Files written by a world with a different seed, margin, chunk size or number of patterns are ignored
+    std::string spillDirectory;
+
+    ChunkedWorldOptions() :
+        chunkSize(defaultChunkSize),
+        marginWidth(defaultMarginWidth),
+        maxCachedChunks(defaultMaxCachedChunks),
+        maxChunkTries(defaultMaxChunkTries),
+        seed(123)
+    {
+
+    }
+
+    ChunkedWorldOptions& withChunkSize(Size2i size)
+    {
+        chunkSize = size;
+        return *this;
+    }
+
+    ChunkedWorldOptions& withMarginWidth(int width)
+    {
+        marginWidth = width;
+        return *this;
+    }
+
+    ChunkedWorldOptions& withMaxCachedChunks(int count)
+    {
+        maxCachedChunks = count;
+        return *this;
+    }
+
+    ChunkedWorldOptions& withMaxChunkTries(int tries)
+    {
+        maxChunkTries = tries;
+        return *this;
+    }
+
+    ChunkedWorldOptions& withSeed(SeedType s)
+    {
+        seed = s;
+        return *this;
+    }
+
+    ChunkedWorldOptions& withSpillDirectory(std::string dir)
+    {
+        spillDirectory = std::move(dir);
+        return *this;
+    }
+};
+
+// unbounded world generated chunk by chunk on demand
+// chunks are generated in 4 phases depending on the parity of their coordinates,
+// (even, even), (odd, even), (even, odd), (odd, odd).
+// Chunks of the same phase don't touch, not even diagonally, so a chunk only depends
+// on its neighbours from earlier phases, which are pinned in its margin.
+// The margin over later neighbours is left free, so that the chunk leaves them something completable.
+// Every chunk depends only on the world seed and its coordinates, never on the order of requests,
+// and is seam consistent with all of its neighbours, unless one of them fails to generate.
+// not thread safe
+template <typename CellTypeT>
+struct ChunkedWorld
+{
+    using CellType = CellTypeT;
+    using ModelType = Model<CellType>;
+    using OptionsType = ChunkedWorldOptions;
+
+    // the model must outlive the world
+    ChunkedWorld(const ModelType& model, const OptionsType& options) :
+        m_model(model),
+        m_options(options)
+    {
+        assert(m_options.marginWidth >= 1);
+        assert(m_options.marginWidth <= m_options.chunkSize.width);
+        assert(m_options.marginWidth <= m_options.chunkSize.height);
+
+        if (!m_options.spillDirectory.empty())
+        {
+            std::filesystem::create_directories(m_options.spillDirectory);
+        }
+    }
+
+    // std::nullopt if the chunk could not be made consistent with its neighbours
+    [[nodiscard]] std::optional<Array2<CellType>> chunkAt(int cx, int cy)
+    {
+        const auto& waveValues = waveValuesAt(cx, cy);
+        if (!waveValues.has_value())
+        {
+            return std::nullopt;
+        }
+
+        return m_model.decodeCells(waveValues.value());
+    }
+
+    // element ids of the chunk
+    // the reference is valid until the next call
+    [[nodiscard]] const std::optional<Array2<int>>& waveValuesAt(int cx, int cy)
+    {
+        const Coords2i chunk(cx, cy);
+        const std::uint64_t key = keyOf(chunk);
+
+        auto iter = m_cache.find(key);
+        if (iter != m_cache.end())
+        {
+            // most recently used go to the front
+            m_lru.splice(m_lru.begin(), m_lru, iter->second.lruIter);
+            return iter->second.waveValues;
+        }
+
+        std::optional<Array2<int>> waveValues = loadSpilled(chunk);
+        if (!waveValues.has_value())
+        {
+            waveValues = generate(chunk);
+        }
+
+        return insert(chunk, std::move(waveValues));
+    }
+
+    [[nodiscard]] const OptionsType& options() const
+    {
+        return m_options;
+    }
+
+private:
+    struct CacheEntry
+    {
+        std::optional<Array2<int>> waveValues;
+        std::list<Coords2i>::iterator lruIter;
+    };
+
+    const ModelType& m_model;
+    OptionsType m_options;
+
+    // front is the most recently used
+    std::list<Coords2i> m_lru;
+    std::unordered_map<std::uint64_t, CacheEntry> m_cache;
+
+    [[nodiscard]] static std::uint64_t keyOf(Coords2i chunk)
+    {
+        return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(chunk.x)) << 32) | static_cast<std::uint32_t>(chunk.y);
+    }
+
+    [[nodiscard]] static int phaseOf(Coords2i chunk)
+    {
+        return (chunk.x & 1) + (chunk.y & 1) * 2;
+    }
+
+    [[nodiscard]] std::uint64_t seedOf(Coords2i chunk) const
+    {
+        return util::mixSeed(m_options.seed, keyOf(chunk));
+    }
+
+    [[nodiscard]] std::optional<Array2<int>> generate(Coords2i chunk)
+    {
+        const auto [width, height] = m_options.chunkSize;
+        const int margin = m_options.marginWidth;
+        const int phase = phaseOf(chunk);
+
+        Array2<int> partial(Size2i(width + 2 * margin, height + 2 * margin), -1);
+
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                const Coords2i neighbourChunk(chunk.x + dx, chunk.y + dy);
+                if (phaseOf(neighbourChunk) >= phase)
+                {
+                    continue;
+                }
+
+                // a failed neighbour doesn't have anything to be consistent with
+                // the reference is only used before the next lookup, which may evict it
+                const auto& neighbour = waveValuesAt(neighbourChunk.x, neighbourChunk.y);
+                if (!neighbour.has_value())
+                {
+                    continue;
+                }
+
+                // part of the margin covered by the neighbour, in the coordinates of the wave
+                const int beginX = dx < 0 ? 0 : dx == 0 ? margin : margin + width;
+                const int beginY = dy < 0 ? 0 : dy == 0 ? margin : margin + height;
+                const int endX = dx < 0 ? margin : dx == 0 ? margin + width : 2 * margin + width;
+                const int endY = dy < 0 ? margin : dy == 0 ? margin + height : 2 * margin + height;
+                const Coords2i neighbourBegin(margin + dx * width, margin + dy * height);
+
+                const auto& values = neighbour.value();
+                for (int x = beginX; x < endX; ++x)
+                {
+                    for (int y = beginY; y < endY; ++y)
+                    {
+                        partial[x][y] = values[x - neighbourBegin.x][y - neighbourBegin.y];
+                    }
+                }
+            }
+        }
+
+        std::optional<Array2<int>> completed = m_model.completeWaveValues(seedOf(chunk), partial, m_options.maxChunkTries);
+        if (!completed.has_value())
+        {
+            LOG_INFO(g_logger, "Chunk (", chunk.x, ", ", chunk.y, ") is inconsistent with its neighbours");
+            return std::nullopt;
+        }
+
+        return completed.value().template sub<WrappingMode::None>({ margin, margin }, m_options.chunkSize);
+    }
+
+    const std::optional<Array2<int>>& insert(Coords2i chunk, std::optional<Array2<int>>&& waveValues)
+    {
+        while (static_cast<int>(m_cache.size()) >= std::max(m_options.maxCachedChunks, 1))
+        {
+            evictLeastRecentlyUsed();
+        }
+
+        m_lru.emplace_front(chunk);
+        auto& entry = m_cache[keyOf(chunk)];
+        entry.waveValues = std::move(waveValues);
+        entry.lruIter = m_lru.begin();
+        return entry.waveValues;
+    }
+
+    void evictLeastRecentlyUsed()
+    {
+        const Coords2i chunk = m_lru.back();
+        m_lru.pop_back();
+
+        auto iter = m_cache.find(keyOf(chunk));
+        if (iter->second.waveValues.has_value())
+        {
+            spill(chunk, iter->second.waveValues.value());
+        }
+        m_cache.erase(iter);
+    }
+
+    [[nodiscard]] std::string spillPath(Coords2i chunk) const
+    {
+        return m_options.spillDirectory + "/" + std::to_string(chunk.x) + "_" + std::to_string(chunk.y) + ".chunk";
+    }
+
+    // what the chunks depend on, written before the values
+    // so that files of another world in the same directory are not loaded
+    struct SpillHeader
+    {
+        std::uint64_t seed;
+        std::int32_t numPatterns;
+        std::int32_t marginWidth;
+        std::int32_t width;
+        std::int32_t height;
+
+        [[nodiscard]] friend bool operator==(const SpillHeader& lhs, const SpillHeader& rhs) noexcept
+        {
+            return
+                lhs.seed == rhs.seed
+                && lhs.numPatterns == rhs.numPatterns
+                && lhs.marginWidth == rhs.marginWidth
+                && lhs.width == rhs.width
+                && lhs.height == rhs.height;
+        }
+    };
+
+    [[nodiscard]] SpillHeader spillHeader() const
+    {
+        return SpillHeader{
+            m_options.seed,
+            m_model.patterns().size(),
+            m_options.marginWidth,
+            m_options.chunkSize.width,
+            m_options.chunkSize.height
+        };
+    }
+
+    // raw dump: the header, then values in column-major order
+    // overwrites whatever was there before
+    void spill(Coords2i chunk, const Array2<int>& waveValues) const
+    {
+        if (m_options.spillDirectory.empty())
+        {
+            return;
+        }
+
+        const SpillHeader header = spillHeader();
+        std::ofstream file(spillPath(chunk), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header.seed), sizeof(header.seed));
+        file.write(reinterpret_cast<const char*>(&header.numPatterns), sizeof(header.numPatterns));
+        file.write(reinterpret_cast<const char*>(&header.marginWidth), sizeof(header.marginWidth));
+        file.write(reinterpret_cast<const char*>(&header.width), sizeof(header.width));
+        file.write(reinterpret_cast<const char*>(&header.height), sizeof(header.height));
+        file.write(reinterpret_cast<const char*>(waveValues.data()), sizeof(int) * waveValues.size().total());
+    }
+
+    [[nodiscard]] std::optional<Array2<int>> loadSpilled(Coords2i chunk) const
+    {
+        if (m_options.spillDirectory.empty())
+        {
+            return std::nullopt;
+        }
+
+        std::ifstream file(spillPath(chunk), std::ios::binary);
+        if (!file)
+        {
+            return std::nullopt;
+        }
+
+        SpillHeader header{};
+        file.read(reinterpret_cast<char*>(&header.seed), sizeof(header.seed));
+        file.read(reinterpret_cast<char*>(&header.numPatterns), sizeof(header.numPatterns));
+        file.read(reinterpret_cast<char*>(&header.marginWidth), sizeof(header.marginWidth));
+        file.read(reinterpret_cast<char*>(&header.width), sizeof(header.width));
+        file.read(reinterpret_cast<char*>(&header.height), sizeof(header.height));
+        if (!file || !(header == spillHeader()))
+        {
+            LOG_WARNING(g_logger, "Ignoring spilled chunk (", chunk.x, ", ", chunk.y, ") of a different world");
+            return std::nullopt;
+        }
+
+        Array2<int> waveValues(m_options.chunkSize);
+        file.read(reinterpret_cast<char*>(waveValues.data()), sizeof(int) * waveValues.size().total());
+        if (!file)
+        {
+            LOG_WARNING(g_logger, "Ignoring truncated spilled chunk (", chunk.x, ", ", chunk.y, ")");
+            return std::nullopt;
+        }
+
+        const int numPatterns = header.numPatterns;
+        const bool areIdsValid = std::all_of(std::begin(waveValues), std::end(waveValues), [numPatterns](int id) {
+            return id >= 0 && id < numPatterns;
+        });
+        if (!areIdsValid)
+        {
+            LOG_WARNING(g_logger, "Ignoring corrupt spilled chunk (", chunk.x, ", ", chunk.y, ")");
+            return std::nullopt;
+        }
+
+        return waveValues;
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Direction.h"
+#include "Span.h"
+
+// for every element and direction the sorted list of elements that
+// can be placed next to it in that direction
+// all lists are stored back to back in a single array (CSR), element ids are 16 bit
+// so four times as many of them fit in a cache line as with vectors of ints
+struct CompatibilityTable
+{
+    using IdType = std::uint16_t;
+    using ListType = IterSpan<const IdType*>;
+
+    static constexpr int maxNumElements = 1 << 16;
+
+    // non owning, stays valid when the table is moved
+    struct View
+    {
+        const std::uint32_t* offsets;
+        const IdType* ids;
+
+        [[nodiscard]] ListType operator()(int elementId, Direction dir) const
+        {
+            const int list = listIndex(elementId, dir);
+            return ListType(ids + offsets[list], ids + offsets[list + 1]);
+        }
+    };
+
+    CompatibilityTable() :
+        m_numElements(0),
+        m_offsets(1, 0)
+    {
+    }
+
+    [[nodiscard]] int numElements() const
+    {
+        return m_numElements;
+    }
+
+    // total length of all lists
+    [[nodiscard]] int numEntries() const
+    {
+        return static_cast<int>(m_ids.size());
+    }
+
+    [[nodiscard]] ListType operator()(int elementId, Direction dir) const
+    {
+        assert(elementId >= 0 && elementId < m_numElements);
+
+        return view()(elementId, dir);
+    }
+
+    [[nodiscard]] View view() const
+    {
+        return View{ m_offsets.data(), m_ids.data() };
+    }
+
+    [[nodiscard]] bool areCompatibile(int first, Direction dir, int second) const
+    {
+        const ListType list = operator()(first, dir);
+        return std::binary_search(list.begin(), list.end(), static_cast<IdType>(second));
+    }
+
+private:
+    friend struct CompatibilityTableBuilder;
+
+    int m_numElements;
+
+    // list (elementId, dir) is m_ids[m_offsets[i], m_offsets[i + 1]) where i = listIndex(elementId, dir)
+    std::vector<std::uint32_t> m_offsets;
+    std::vector<IdType> m_ids;
+
+    [[nodiscard]] static int listIndex(int elementId, Direction dir)
+    {
+        return elementId * cardinality<Direction>() + toId(dir);
+    }
+};
+
+// every compatibile pair is added once, from either side
+// the list of the other side is filled too, duplicates are removed in build()
+struct CompatibilityTableBuilder
+{
+    explicit CompatibilityTableBuilder(int numElements) :
+        m_numElements(numElements)
+    {
+        assert(numElements >= 0 && numElements <= CompatibilityTable::maxNumElements);
+    }
+
+    // `second` can be placed next to `first` in the `dir` direction
+    // and so `first` next to `second` in the opposite direction
+    void add(int first, Direction dir, int second)
+    {
+        assert(first >= 0 && first < m_numElements);
+        assert(second >= 0 && second < m_numElements);
+
+        m_pairs.emplace_back(Pair{ CompatibilityTable::listIndex(first, dir), static_cast<IdType>(second) });
+        m_pairs.emplace_back(Pair{ CompatibilityTable::listIndex(second, oppositeTo(dir)), static_cast<IdType>(first) });
+    }
+
+    [[nodiscard]] CompatibilityTable build() &&
+    {
+        const int numLists = m_numElements * cardinality<Direction>();
+
+        CompatibilityTable table;
+        table.m_numElements = m_numElements;
+
+        // counting sort of the pairs by list
+        std::vector<std::uint32_t> starts(numLists + 1, 0);
+        for (const Pair& pair : m_pairs)
+        {
+            starts[pair.list + 1] += 1;
+        }
+        for (int i = 0; i < numLists; ++i)
+        {
+            starts[i + 1] += starts[i];
+        }
+
+        std::vector<IdType> ids(m_pairs.size());
+        {
+            std::vector<std::uint32_t> next(std::begin(starts), std::end(starts) - 1);
+            for (const Pair& pair : m_pairs)
+            {
+                ids[next[pair.list]++] = pair.id;
+            }
+        }
+        m_pairs.clear();
+        m_pairs.shrink_to_fit();
+
+        // then each list is sorted and compacted in place
+        table.m_offsets.resize(numLists + 1);
+        std::uint32_t size = 0;
+        for (int i = 0; i < numLists; ++i)
+        {
+            auto begin = std::begin(ids) + starts[i];
+            auto end = std::begin(ids) + starts[i + 1];
+            std::sort(begin, end);
+            end = std::unique(begin, end);
+
+            table.m_offsets[i] = size;
+            if (size != starts[i])
+            {
+                std::copy(begin, end, std::begin(ids) + size);
+            }
+            size += static_cast<std::uint32_t>(end - begin);
+        }
+        table.m_offsets[numLists] = size;
+
+        ids.resize(size);
+        ids.shrink_to_fit();
+        table.m_ids = std::move(ids);
+
+        return table;
+    }
+
+private:
+    using IdType = CompatibilityTable::IdType;
+
+    struct Pair
+    {
+        int list;
+        IdType id;
+    };
+
+    int m_numElements;
+    std::vector<Pair> m_pairs;
+};
@@ -0,0 +1,514 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "EntropyQueueBackend.h"
+#include "UpdatablePriorityQueue.h"
+#include "Util.h"
+
+// Entropy queues keep cells of a wave, identified by their flat index,
+// ordered by entropy. They all have the same interface:
+//   Queue(int capacity)            - cells have indices in [0, capacity)
+//   empty()
+//   top()                          - the cell with the lowest entropy, as an EntropyQueueEntry
+//                                    ties are broken by the lowest index, never by the order of insertion
+//   contains(index)
+//   push(index, entropy)           - the cell must not be queued
+//   update(index, entropy)         - the cell must be queued
+//   erase(index)                   - the cell must be queued
+//   clear()                        - proportional to the number of queued cells
+
+struct EntropyQueueEntry
+{
+    float entropy;
+
+    int index;
+
+    // by the index when the entropies are equal, so that the order of the cells
+    // doesn't depend on the order in which they were queued
+    [[nodiscard]] friend bool operator<(EntropyQueueEntry lhs, EntropyQueueEntry rhs) noexcept
+    {
+        return lhs.entropy < rhs.entropy || (lhs.entropy == rhs.entropy && lhs.index < rhs.index);
+    }
+
+    [[nodiscard]] friend bool operator>(EntropyQueueEntry lhs, EntropyQueueEntry rhs) noexcept
+    {
+        return !(operator<(lhs, rhs));
+    }
+};
+
+// EntropyQueueBackend::Tree
+struct TreeEntropyQueue
+{
+    using QueueType = UpdatablePriorityQueue<EntropyQueueEntry>;
+    using NodeHandle = typename QueueType::NodeHandle;
+
+    explicit TreeEntropyQueue(int capacity) :
+        m_queue(capacity),
+        m_handles(capacity, nullptr)
+    {
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return m_queue.empty();
+    }
+
+    [[nodiscard]] EntropyQueueEntry top()
+    {
+        return m_queue.top();
+    }
+
+    [[nodiscard]] bool contains(int index) const
+    {
+        return m_handles[index] != nullptr;
+    }
+
+    void push(int index, float entropy)
+    {
+        assert(!contains(index));
+
+        m_handles[index] = m_queue.push(EntropyQueueEntry{ entropy, index });
+    }
+
+    void update(int index, float entropy)
+    {
+        m_queue.update(m_handles[index], [entropy](EntropyQueueEntry& e) { e.entropy = entropy; });
+    }
+
+    void erase(int index)
+    {
+        m_queue.erase(m_handles[index]);
+        m_handles[index] = nullptr;
+    }
+
+    void clear()
+    {
+        m_queue.forEach([this](NodeHandle node) { m_handles[node->value.index] = nullptr; });
+        m_queue.clear();
+    }
+
+private:
+    QueueType m_queue;
+
+    // m_handles[index] is the node of the cell, nullptr when it's not queued
+    std::vector<NodeHandle> m_handles;
+};
+
+// EntropyQueueBackend::IndexedHeap
+// ArityV-ary min heap, positions of the cells in the heap are tracked
+// so that any cell can be updated or erased in logarithmic time
+template <int ArityV = 4>
+struct BasicIndexedHeapEntropyQueue
+{
+    static_assert(ArityV >= 2);
+
+    explicit BasicIndexedHeapEntropyQueue(int capacity) :
+        m_positions(capacity, notQueued)
+    {
+        m_heap.reserve(capacity);
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return m_heap.empty();
+    }
+
+    [[nodiscard]] EntropyQueueEntry top() const
+    {
+        return m_heap.front();
+    }
+
+    [[nodiscard]] bool contains(int index) const
+    {
+        return m_positions[index] != notQueued;
+    }
+
+    void push(int index, float entropy)
+    {
+        assert(!contains(index));
+
+        m_heap.push_back(EntropyQueueEntry{ entropy, index });
+        siftUp(static_cast<int>(m_heap.size()) - 1);
+    }
+
+    void update(int index, float entropy)
+    {
+        const int pos = m_positions[index];
+        const EntropyQueueEntry old = m_heap[pos];
+        m_heap[pos].entropy = entropy;
+        if (m_heap[pos] < old)
+        {
+            siftUp(pos);
+        }
+        else
+        {
+            siftDown(pos);
+        }
+    }
+
+    void erase(int index)
+    {
+        const int pos = m_positions[index];
+        m_positions[index] = notQueued;
+
+        const EntropyQueueEntry last = m_heap.back();
+        m_heap.pop_back();
+        if (pos == static_cast<int>(m_heap.size()))
+        {
+            return;
+        }
+
+        // the last entry takes the place of the erased one and may have to go either way
+        const EntropyQueueEntry erased = m_heap[pos];
+        m_heap[pos] = last;
+        if (last < erased)
+        {
+            siftUp(pos);
+        }
+        else
+        {
+            siftDown(pos);
+        }
+    }
+
+    void clear()
+    {
+        for (const EntropyQueueEntry& e : m_heap)
+        {
+            m_positions[e.index] = notQueued;
+        }
+        m_heap.clear();
+    }
+
+private:
+    static constexpr std::int32_t notQueued = -1;
+
+    std::vector<EntropyQueueEntry> m_heap;
+
+    // m_positions[index] is the position of the cell in m_heap, notQueued when it's not there
+    std::vector<std::int32_t> m_positions;
+
+    // the entry at `pos` is moved, not swapped, until it finds its place
+    void siftUp(int pos)
+    {
+        const EntropyQueueEntry e = m_heap[pos];
+        while (pos > 0)
+        {
+            const int parent = (pos - 1) / ArityV;
+            if (!(e < m_heap[parent]))
+            {
+                break;
+            }
+
+            place(pos, m_heap[parent]);
+            pos = parent;
+        }
+        place(pos, e);
+    }
+
+    void siftDown(int pos)
+    {
+        const int size = static_cast<int>(m_heap.size());
+        const EntropyQueueEntry e = m_heap[pos];
+        for (;;)
+        {
+            const int firstChild = pos * ArityV + 1;
+            if (firstChild >= size)
+            {
+                break;
+            }
+
+            const int lastChild = std::min(firstChild + ArityV, size);
+            int minChild = firstChild;
+            for (int child = firstChild + 1; child < lastChild; ++child)
+            {
+                if (m_heap[child] < m_heap[minChild])
+                {
+                    minChild = child;
+                }
+            }
+
+            if (!(m_heap[minChild] < e))
+            {
+                break;
+            }
+
+            place(pos, m_heap[minChild]);
+            pos = minChild;
+        }
+        place(pos, e);
+    }
+
+    void place(int pos, EntropyQueueEntry e)
+    {
+        m_heap[pos] = e;
+        m_positions[e.index] = pos;
+    }
+};
+
+using IndexedHeapEntropyQueue = BasicIndexedHeapEntropyQueue<>;
+
+// EntropyQueueBackend::Bucket
+// the bucket of an entropy is given by the highest bits of its float representation
+// which for non negative floats is monotonic, so there is no need to know the range up front.
+// Each bucket is a binary heap, so the exact minimum is always at the front of the first non empty bucket
+// and updates only sift through the cells of one bucket. Non empty buckets are found with a two level bitmap.
+struct BucketEntropyQueue
+{
+    // number of mantissa bits kept, each bucket spans 1/32 of a power of two
+    static constexpr int numMantissaBits = 5;
+
+    static constexpr int bucketShift = 23 - numMantissaBits;
+
+    // sign bit is never set, it's clamped to 0
+    static constexpr int numBuckets = 1 << (31 - bucketShift);
+
+    static constexpr int bitsPerWord = 64;
+    static constexpr int numBucketWords = numBuckets / bitsPerWord;
+    static constexpr int numSummaryWords = (numBucketWords + bitsPerWord - 1) / bitsPerWord;
+
+    explicit BucketEntropyQueue(int capacity) :
+        m_size(0),
+        m_heaps(numBuckets),
+        m_nonEmptyBuckets{},
+        m_nonEmptyBucketWords{},
+        m_buckets(capacity, none),
+        m_positions(capacity)
+    {
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] EntropyQueueEntry top() const
+    {
+        return m_heaps[firstNonEmptyBucket()].front();
+    }
+
+    [[nodiscard]] bool contains(int index) const
+    {
+        return m_buckets[index] != none;
+    }
+
+    void push(int index, float entropy)
+    {
+        assert(!contains(index));
+
+        insert(EntropyQueueEntry{ entropy, index }, bucketOf(entropy));
+        m_size += 1;
+    }
+
+    void update(int index, float entropy)
+    {
+        const int bucket = bucketOf(entropy);
+        if (bucket != m_buckets[index])
+        {
+            remove(index);
+            insert(EntropyQueueEntry{ entropy, index }, bucket);
+            return;
+        }
+
+        auto& heap = m_heaps[bucket];
+        const int pos = m_positions[index];
+        const EntropyQueueEntry old = heap[pos];
+        heap[pos].entropy = entropy;
+        if (heap[pos] < old)
+        {
+            siftUp(heap, pos);
+        }
+        else
+        {
+            siftDown(heap, pos);
+        }
+    }
+
+    void erase(int index)
+    {
+        remove(index);
+        m_buckets[index] = none;
+        m_size -= 1;
+    }
+
+    // proportional to the number of queued cells and non empty buckets
+    void clear()
+    {
+        while (m_size > 0)
+        {
+            const int bucket = firstNonEmptyBucket();
+            auto& heap = m_heaps[bucket];
+            for (const EntropyQueueEntry& e : heap)
+            {
+                m_buckets[e.index] = none;
+            }
+            m_size -= static_cast<int>(heap.size());
+            heap.clear();
+            markEmpty(bucket);
+        }
+    }
+
+private:
+    static constexpr std::int32_t none = -1;
+
+    int m_size;
+
+    // heap ordered cells of each bucket, the memory of a bucket is kept when it becomes empty
+    std::vector<std::vector<EntropyQueueEntry>> m_heaps;
+
+    // bit i is set iff bucket i is not empty
+    std::array<std::uint64_t, numBucketWords> m_nonEmptyBuckets;
+
+    // bit i is set iff m_nonEmptyBuckets[i] != 0
+    std::array<std::uint64_t, numSummaryWords> m_nonEmptyBucketWords;
+
+    // per cell, the bucket is none when the cell is not queued
+    // the position is in the heap of the bucket
+    std::vector<std::int32_t> m_buckets;
+    std::vector<std::int32_t> m_positions;
+
+    [[nodiscard]] static int bucketOf(float entropy)
+    {
+        if (!(entropy > 0.0f))
+        {
+            return 0;
+        }
+
+        static_assert(sizeof(float) == sizeof(std::uint32_t));
+
+        std::uint32_t bits;
+        std::memcpy(&bits, &entropy, sizeof(float));
+        return static_cast<int>(bits >> bucketShift);
+    }
+
+    [[nodiscard]] int firstNonEmptyBucket() const
+    {
+        for (int i = 0; i < numSummaryWords; ++i)
+        {
+            if (m_nonEmptyBucketWords[i])
+            {
+                const int wordId = i * bitsPerWord + util::findFirstSet(m_nonEmptyBucketWords[i]);
+                return wordId * bitsPerWord + util::findFirstSet(m_nonEmptyBuckets[wordId]);
+            }
+        }
+
+        assert(false);
+        return 0;
+    }
+
+    void insert(EntropyQueueEntry e, int bucket)
+    {
+        auto& heap = m_heaps[bucket];
+        if (heap.empty())
+        {
+            const int wordId = bucket / bitsPerWord;
+            m_nonEmptyBuckets[wordId] |= std::uint64_t(1) << (bucket % bitsPerWord);
+            m_nonEmptyBucketWords[wordId / bitsPerWord] |= std::uint64_t(1) << (wordId % bitsPerWord);
+        }
+
+        m_buckets[e.index] = bucket;
+        heap.push_back(e);
+        siftUp(heap, static_cast<int>(heap.size()) - 1);
+    }
+
+    // doesn't reset m_buckets[index]
+    void remove(int index)
+    {
+        const int bucket = m_buckets[index];
+        auto& heap = m_heaps[bucket];
+        const int pos = m_positions[index];
+
+        const EntropyQueueEntry last = heap.back();
+        heap.pop_back();
+        if (heap.empty())
+        {
+            markEmpty(bucket);
+            return;
+        }
+
+        if (pos == static_cast<int>(heap.size()))
+        {
+            return;
+        }
+
+        // the last entry takes the place of the removed one and may have to go either way
+        const EntropyQueueEntry removed = heap[pos];
+        heap[pos] = last;
+        if (last < removed)
+        {
+            siftUp(heap, pos);
+        }
+        else
+        {
+            siftDown(heap, pos);
+        }
+    }
+
+    void markEmpty(int bucket)
+    {
+        const int wordId = bucket / bitsPerWord;
+        m_nonEmptyBuckets[wordId] &= ~(std::uint64_t(1) << (bucket % bitsPerWord));
+        if (!m_nonEmptyBuckets[wordId])
+        {
+            m_nonEmptyBucketWords[wordId / bitsPerWord] &= ~(std::uint64_t(1) << (wordId % bitsPerWord));
+        }
+    }
+
+    // the entry at `pos` is moved, not swapped, until it finds its place
+    void siftUp(std::vector<EntropyQueueEntry>& heap, int pos)
+    {
+        const EntropyQueueEntry e = heap[pos];
+        while (pos > 0)
+        {
+            const int parent = (pos - 1) / 2;
+            if (!(e < heap[parent]))
+            {
+                break;
+            }
+
+            place(heap, pos, heap[parent]);
+            pos = parent;
+        }
+        place(heap, pos, e);
+    }
+
+    void siftDown(std::vector<EntropyQueueEntry>& heap, int pos)
+    {
+        const int size = static_cast<int>(heap.size());
+        const EntropyQueueEntry e = heap[pos];
+        for (;;)
+        {
+            int minChild = pos * 2 + 1;
+            if (minChild >= size)
+            {
+                break;
+            }
+
+            if (minChild + 1 < size && heap[minChild + 1] < heap[minChild])
+            {
+                minChild += 1;
+            }
+
+            if (!(heap[minChild] < e))
+            {
+                break;
+            }
+
+            place(heap, pos, heap[minChild]);
+            pos = minChild;
+        }
+        place(heap, pos, e);
+    }
+
+    void place(std::vector<EntropyQueueEntry>& heap, int pos, EntropyQueueEntry e)
+    {
+        heap[pos] = e;
+        m_positions[e.index] = pos;
+    }
+};
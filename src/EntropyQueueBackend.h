@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+enum struct EntropyQueueBackend : std::uint8_t
+{
+    // scapegoat tree based UpdatablePriorityQueue
+    // exact, memory is allocated once for the whole wave
+    Tree,
+
+    // 4-ary heap in an array, cells know their position in it
+    // exact, no pointer chasing
+    IndexedHeap,
+
+    // cells are bucketed by the entropy rounded to a few significant bits, each bucket is a small heap
+    // exact, updates are logarithmic in the number of cells in the bucket instead of the whole queue
+    Bucket
+};
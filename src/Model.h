@@ -2,23 +2,44 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <future>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <optional>
 #include <random>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "Array2.h"
+#include "CompatibilityTable.h"
+#include "Coords2.h"
 #include "D4Symmetry.h"
 #include "Direction.h"
+#include "EntropyQueueBackend.h"
 #include "Logger.h"
 #include "NormalizedHistogram.h"
+#include "ObservationHeuristic.h"
+#include "PropagationEngine.h"
+#include "RandomNumberMode.h"
 #include "Size2.h"
 #include "SmallVector.h"
+#include "ThreadPool.h"
+#include "Util.h"
 #include "Wave.h"
+#include "WavePool.h"
 #include "WrappingMode.h"
 
+// the wave cell at `pos` can only hold one of `allowedElements`, which are ids in Model::patterns()
+struct CellConstraint
+{
+    Coords2i pos;
+    std::vector<int> allowedElements;
+};
+
 template <typename CellTypeT>
 struct Model
 {
@@ -41,40 +62,51 @@ struct Model
 
     [[nodiscard]] virtual std::optional<Array2<CellType>> next(WaveSeedType seed)
     {
-        Wave wave(m_compatibile, seed, this->waveSize(), m_patterns, this->outputWrapping());
+        const bool isChunked = this->isChunked();
 
-        std::vector<float> ps; // preallocate for observeOnce
-        ps.resize(m_patterns.size());
-
-        for (;;)
-        {
-            switch (wave.observeOnce(ps))
-            {
-            case Wave::ObservationResult::Contradiction:
-                return std::nullopt;
-            case Wave::ObservationResult::Finished:
-                return this->decodeOutput(std::move(wave));
-            default:
-                continue;
-            }
-        }
+        // the smaller the wave type the more work is done with compile time known bounds
+        return withWaveTypeFor(m_patterns.size(), this->entropyQueueBackend(), [this, seed, isChunked](auto waveTypeTag) {
+            using WaveType = typename decltype(waveTypeTag)::Type;
+            return isChunked ? nextChunkedImpl<WaveType>(seed) : nextImpl<WaveType>(seed);
+        });
     }
 
     // does `tries` waves (in parallel) and returns successful tries
     // so may return less elements than `tries`.
     // uses std::async for thread scheduling
+    // there is at most one worker per hardware thread, each of them
+    // takes the next try when done, so that its pooled waves are reused
     [[nodiscard]] virtual std::vector<Array2<CellType>> tryNextN(std::execution::parallel_policy, int tries)
     {
-        std::vector<std::future<std::optional<Array2<CellType>>>> futures;
-        for (int i = 0; i < tries; ++i)
+        std::vector<WaveSeedType> seeds(tries);
+        for (auto& seed : seeds)
+        {
+            seed = m_rng();
+        }
+
+        std::vector<std::optional<Array2<CellType>>> tryResults(tries);
+        std::atomic<int> nextTry = 0;
+        const int numWorkers = std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1, std::max(tries, 1));
+
+        std::vector<std::future<void>> workers;
+        for (int i = 0; i < numWorkers; ++i)
         {
-            futures.emplace_back(std::async(std::launch::async, [seed = m_rng(), this]() { return next(seed); }));
+            workers.emplace_back(std::async(std::launch::async, [&seeds, &tryResults, &nextTry, tries, this]() {
+                for (int t = nextTry++; t < tries; t = nextTry++)
+                {
+                    tryResults[t] = next(seeds[t]);
+                }
+            }));
         }
-        
+
+        for (auto&& worker : workers)
+        {
+            worker.get();
+        }
+
         std::vector<Array2<CellType>> results;
-        for (auto&& future : futures)
+        for (auto&& result : tryResults)
         {
-            std::optional<Array2<CellType>> result = future.get();
             if (result.has_value())
             {
                 results.emplace_back(std::move(result.value()));
@@ -83,9 +115,151 @@ struct Model
         return results;
     }
 
+    // every following generation only places allowed elements in the constrained cells
+    // positions are in wave cells, like in completeWaveValues (which ignores the constraints)
+    // and constraints outside of the wave or in masked out cells are skipped.
+    // The constraints are applied and propagated once here, every try starts from a copy of the result.
+    // Chunks of a chunked output are constrained separately, a chunk only sees the constraints
+    // within its margin, so constraints near chunk edges may make it fail.
+    // Replaces the previous constraints, not thread safe.
+    void setConstraints(std::vector<CellConstraint> constraints)
+    {
+        m_constraints = std::move(constraints);
+        m_constrainedWave.reset();
+
+        if (m_constraints.empty() || isChunked())
+        {
+            return;
+        }
+
+        withWaveTypeFor(m_patterns.size(), this->entropyQueueBackend(), [this](auto waveTypeTag) {
+            using WaveType = typename decltype(waveTypeTag)::Type;
+            auto wave = std::make_shared<WaveType>(m_compatibile, 0, this->waveSize(), m_patterns, this->outputWrapping(), this->propagationEngine(), this->observationHeuristic(), this->randomNumberMode());
+            applyMask(*wave, Coords2i(0, 0));
+            applyConstraints(*wave, Coords2i(0, 0));
+            m_constrainedWave = std::move(wave);
+        });
+    }
+
+    [[nodiscard]] const std::vector<CellConstraint>& constraints() const
+    {
+        return m_constraints;
+    }
+
+    // generates the wave cells in the rectangle at `origin` of size `size` of `output`, an output of next(), again
+    // and writes the new cells back into `output`. The wave only covers the rectangle and a one cell margin
+    // pinned to the elements already there, so the cost depends on the size of the rectangle, not of the output.
+    // A rectangle spanning a whole wrapping axis wraps instead of having a margin on that axis.
+    // The constraints and the mask are applied, up to maxChunkTries() seeds derived from `seed` are tried.
+    // Returns false and leaves `output` unchanged when all of them fail
+    // or when the cells around the rectangle don't match any element.
+    [[nodiscard]] bool regenerate(Array2<CellType>& output, Coords2i origin, Size2i size, WaveSeedType seed) const
+    {
+        const Size2i waveSize = this->waveSize();
+        const WrappingMode outputWrapping = isChunked() ? WrappingMode::None : this->outputWrapping();
+
+        assert(origin.x >= 0 && origin.y >= 0);
+        assert(origin.x + size.width <= waveSize.width && origin.y + size.height <= waveSize.height);
+
+        // [begin, end) is the area of the wave, it's outside of the output when the margin wraps
+        Coords2i begin;
+        Coords2i end;
+        WrappingMode wrapping = WrappingMode::None;
+        const auto computeAxis = [](int origin, int size, int waveSize, bool wraps, int& begin, int& end) {
+            if (wraps && size == waveSize)
+            {
+                begin = 0;
+                end = waveSize;
+                return true;
+            }
+
+            begin = wraps ? origin - 1 : std::max(origin - 1, 0);
+            end = wraps ? origin + size + 1 : std::min(origin + size + 1, waveSize);
+            return false;
+        };
+        if (computeAxis(origin.x, size.width, waveSize.width, contains(outputWrapping, WrappingMode::Horizontal), begin.x, end.x))
+        {
+            wrapping = wrapping | WrappingMode::Horizontal;
+        }
+        if (computeAxis(origin.y, size.height, waveSize.height, contains(outputWrapping, WrappingMode::Vertical), begin.y, end.y))
+        {
+            wrapping = wrapping | WrappingMode::Vertical;
+        }
+
+        const auto wrapToWave = [waveSize](Coords2i pos) {
+            return Coords2i(
+                (pos.x % waveSize.width + waveSize.width) % waveSize.width,
+                (pos.y % waveSize.height + waveSize.height) % waveSize.height
+            );
+        };
+
+        Array2<int> partial(Size2i(end.x - begin.x, end.y - begin.y), -1);
+        for (int x = begin.x; x < end.x; ++x)
+        {
+            for (int y = begin.y; y < end.y; ++y)
+            {
+                const bool isInside =
+                    x >= origin.x && x < origin.x + size.width
+                    && y >= origin.y && y < origin.y + size.height;
+                if (isInside || isMaskedOut(wrapToWave({ x, y })))
+                {
+                    continue;
+                }
+
+                const int elementId = elementAt(output, wrapToWave({ x, y }));
+                if (elementId < 0)
+                {
+                    return false;
+                }
+
+                partial[x - begin.x][y - begin.y] = elementId;
+            }
+        }
+
+        const std::optional<Array2<int>> completed = withWaveTypeFor(m_patterns.size(), this->entropyQueueBackend(), [&](auto waveTypeTag) {
+            using WaveType = typename decltype(waveTypeTag)::Type;
+            return completeWaveValuesImpl<WaveType>(seed, partial, this->maxChunkTries(), wrapping, begin);
+        });
+        if (!completed.has_value())
+        {
+            return false;
+        }
+
+        for (int x = origin.x; x < origin.x + size.width; ++x)
+        {
+            for (int y = origin.y; y < origin.y + size.height; ++y)
+            {
+                const int elementId = completed.value()[x - begin.x][y - begin.y];
+                if (elementId >= 0)
+                {
+                    placeElement(output, { x, y }, elementId);
+                }
+            }
+        }
+
+        return true;
+    }
+
     // TODO: parallel version that returns exactly n results
     //       and uses a single (lock free) queue to schedule work
 
+    // fills the cells of `partial` that are -1 so that all adjacent cells are compatibile
+    // other cells are kept as they are, the wave doesn't wrap and isn't masked
+    // up to `maxTries` seeds derived from `seed` are tried, std::nullopt if all fail
+    [[nodiscard]] std::optional<Array2<int>> completeWaveValues(WaveSeedType seed, const Array2<int>& partial, int maxTries) const
+    {
+        return withWaveTypeFor(m_patterns.size(), this->entropyQueueBackend(), [this, seed, &partial, maxTries](auto waveTypeTag) {
+            using WaveType = typename decltype(waveTypeTag)::Type;
+            return completeWaveValuesImpl<WaveType>(seed, partial, maxTries, WrappingMode::None, std::nullopt);
+        });
+    }
+
+    // decodes wave values into cells, every wave cell maps to the same number of cells
+    // unlike the output of next() it has no extra border for non wrapping outputs
+    // so results for adjacent blocks of wave values can be placed next to each other
+    // cells of masked out wave cells, which are -1, are left default constructed
+    [[nodiscard]] virtual Array2<CellType> decodeCells(const Array2<int>& waveValues) const = 0;
+
     [[nodiscard]] virtual const Patterns<CellType>& patterns() const final
     {
         return m_patterns;
@@ -97,25 +271,539 @@ struct Model
     }
 
 protected:
-    Model(Patterns<CellType>&& patterns, CompatibilityArrayType&& compatibility, ModelSeedType seed) :
+    // patterns that can't be placed in an output wrapping as `outputWrapping` are removed,
+    // see removeUnsupportedPatterns
+    Model(Patterns<CellType>&& patterns, CompatibilityArrayType&& compatibility, WrappingMode outputWrapping, ModelSeedType seed) :
         m_compatibile(std::move(compatibility)),
         m_patterns(std::move(patterns)),
         m_rng(seed)
     {
+        removeUnsupportedPatterns(outputWrapping);
     }
 
-    [[nodiscard]] virtual Array2<CellType> decodeOutput(Wave&& wave) const = 0;
+    // waveValues[x][y] is the id of the element at (x, y) in the finished wave, -1 when it's masked out
+    [[nodiscard]] virtual Array2<CellType> decodeOutput(const Array2<int>& waveValues) const = 0;
+
+    // the first cell of an output of next() covered by the element at the wave cell `pos`
+    // elements cover a square of cells the size of the pattern, wrapping around the output
+    [[nodiscard]] virtual Coords2i outputCellOf(Coords2i pos) const = 0;
 
     [[nodiscard]] virtual Size2i waveSize() const = 0;
 
     [[nodiscard]] virtual WrappingMode outputWrapping() const = 0;
 
+    [[nodiscard]] virtual PropagationEngine propagationEngine() const = 0;
+
+    [[nodiscard]] virtual EntropyQueueBackend entropyQueueBackend() const = 0;
+
+    [[nodiscard]] virtual ObservationHeuristic observationHeuristic() const = 0;
+
+    [[nodiscard]] virtual RandomNumberMode randomNumberMode() const = 0;
+
+    // size of the wave generated at once, in wave cells
+    // {0, 0} when the whole wave is generated at once
+    [[nodiscard]] virtual Size2i chunkSize() const = 0;
+
+    // how many times generation of a single chunk is retried before giving up
+    [[nodiscard]] virtual int maxChunkTries() const = 0;
+
+    // how many observations can be undone in a single try, 0 disables backtracking
+    [[nodiscard]] virtual int maxBacktracks() const = 0;
+
+    // true for the wave cells that are generated, empty when all of them are
+    [[nodiscard]] virtual const Array2<bool>& mask() const = 0;
+
 private:
-    // m_compatibility[elementId][dir] contains all elements that
+    // arc consistency over the pattern graph. Along an axis on which the output wraps
+    // every cell has neighbours on both sides, so a pattern with no compatibile pattern
+    // in one of these directions can never be placed, nor can the patterns left without
+    // support after it's gone. They are removed once here instead of in every wave.
+    // The remaining patterns keep their order, get consecutive ids
+    // and their frequencies are renormalized.
+    void removeUnsupportedPatterns(WrappingMode outputWrapping)
+    {
+        const int numPatterns = m_patterns.size();
+
+        std::vector<Direction> wrappingDirections;
+        for (Direction dir : values<Direction>())
+        {
+            const WrappingMode axis = offset(dir).x != 0 ? WrappingMode::Horizontal : WrappingMode::Vertical;
+            if (contains(outputWrapping, axis))
+            {
+                wrappingDirections.emplace_back(dir);
+            }
+        }
+
+        // numSupports[p * 4 + dir] is the number of not removed patterns compatibile with p in dir
+        std::vector<int> numSupports(numPatterns * cardinality<Direction>(), 0);
+        std::vector<bool> isRemoved(numPatterns, false);
+        std::vector<int> removed;
+        for (int p = 0; p < numPatterns; ++p)
+        {
+            for (Direction dir : wrappingDirections)
+            {
+                const int count = m_compatibile(p, dir).size();
+                numSupports[p * cardinality<Direction>() + toId(dir)] = count;
+                if (count == 0 && !isRemoved[p])
+                {
+                    isRemoved[p] = true;
+                    removed.emplace_back(p);
+                }
+            }
+        }
+
+        // the relation is symmetric, p supports every q compatibile with it in dir in the opposite direction
+        for (std::size_t i = 0; i < removed.size(); ++i)
+        {
+            const int p = removed[i];
+            for (Direction dir : wrappingDirections)
+            {
+                const int opposite = toId(oppositeTo(dir));
+                for (const int q : m_compatibile(p, dir))
+                {
+                    if (!isRemoved[q] && --numSupports[q * cardinality<Direction>() + opposite] == 0)
+                    {
+                        isRemoved[q] = true;
+                        removed.emplace_back(q);
+                    }
+                }
+            }
+        }
+
+        if (removed.empty())
+        {
+            return;
+        }
+
+        if (static_cast<int>(removed.size()) == numPatterns)
+        {
+            LOG_WARNING(g_logger, "No pattern can be placed in a wrapping output");
+            return;
+        }
+
+        std::vector<int> newIds(numPatterns, -1);
+        std::vector<PatternsEntryType> entries;
+        for (int p = 0; p < numPatterns; ++p)
+        {
+            if (!isRemoved[p])
+            {
+                newIds[p] = static_cast<int>(entries.size());
+                entries.emplace_back(m_patterns.element(p), m_patterns.frequency(p));
+            }
+        }
+
+        // every pair is visited from both sides, it's enough to add it from the lower id
+        CompatibilityTableBuilder compatibilities(static_cast<int>(entries.size()));
+        for (int p = 0; p < numPatterns; ++p)
+        {
+            if (isRemoved[p])
+            {
+                continue;
+            }
+
+            for (Direction dir : values<Direction>())
+            {
+                for (const int q : m_compatibile(p, dir))
+                {
+                    if (q >= p && !isRemoved[q])
+                    {
+                        compatibilities.add(newIds[p], dir, newIds[q]);
+                    }
+                }
+            }
+        }
+
+        LOG_INFO(g_logger, "Removed ", removed.size(), " patterns that can't be placed in the output");
+
+        m_patterns = Patterns<CellType>(std::begin(entries), std::end(entries));
+        m_compatibile = std::move(compatibilities).build();
+    }
+
+    template <typename WaveT>
+    [[nodiscard]] static WavePool<WaveT>& wavePool()
+    {
+        // allocating and faulting in the wave storage is a significant part
+        // of a generation, especially for waves ending with an early contradiction
+        static thread_local WavePool<WaveT> pool;
+        return pool;
+    }
+
+    // how far around a chunk its wave reaches, at most the chunk size
+    static constexpr int chunkMarginWidth = 2;
+
+    // a failed chunk is retried with the chunks at most this far from it, with the nearest ones first
+    static constexpr int maxChunkRetryRadius = 2;
+
+    [[nodiscard]] static int chunkPhaseOf(Coords2i chunk)
+    {
+        return (chunk.x & 1) + (chunk.y & 1) * 2;
+    }
+
+    // splits the wave into chunks generated in 4 phases depending on the parity of their coordinates,
+    // like in ChunkedWorld. Chunks of the same phase don't touch, not even diagonally, so they are generated in parallel.
+    // Cells of neighbours from earlier phases are pinned in the margin of a chunk,
+    // the margin over later neighbours is left free so that the chunk leaves them something completable.
+    // A chunk that fails is retried after its phase together with the chunks around it, see maxChunkRetryRadius,
+    // the output fails only if all of these fail too.
+    // at most one chunk wave per thread is alive at a time
+    // output wrapping is not supported here, the output never wraps
+    template <typename WaveT>
+    [[nodiscard]] std::optional<Array2<CellType>> nextChunkedImpl(WaveSeedType seed)
+    {
+        const Size2i waveSize = this->waveSize();
+        const Size2i chunkSize = this->chunkSize();
+        const Size2i numChunks(
+            (waveSize.width + chunkSize.width - 1) / chunkSize.width,
+            (waveSize.height + chunkSize.height - 1) / chunkSize.height
+        );
+
+        Array2<int> waveValues(waveSize, -1);
+        Array2<bool> isGenerated(numChunks, false);
+
+        for (int phase = 0; phase < 4; ++phase)
+        {
+            std::vector<Coords2i> chunks;
+            for (int cx = phase & 1; cx < numChunks.width; cx += 2)
+            {
+                for (int cy = phase >> 1; cy < numChunks.height; cy += 2)
+                {
+                    chunks.emplace_back(cx, cy);
+                }
+            }
+
+            std::vector<char> hasFailed(chunks.size(), false);
+            ThreadPool::instance().parallelFor(static_cast<int>(chunks.size()), 1, [&](int begin, int end) {
+                for (int i = begin; i < end; ++i)
+                {
+                    const Coords2i chunk = chunks[i];
+                    const WaveSeedType chunkSeed = util::mixSeed(seed, chunk.x * numChunks.height + chunk.y);
+                    hasFailed[i] = !generateChunks<WaveT>(waveValues, isGenerated, chunk, chunk + Coords2i(1, 1), phase, chunkSeed);
+                }
+            });
+
+            for (std::size_t i = 0; i < chunks.size(); ++i)
+            {
+                if (!hasFailed[i])
+                {
+                    isGenerated[chunks[i].x][chunks[i].y] = true;
+                }
+            }
+
+            // same phase chunks are all generated now, so they are pinned like the earlier ones
+            for (std::size_t i = 0; i < chunks.size(); ++i)
+            {
+                if (!hasFailed[i])
+                {
+                    continue;
+                }
+
+                const Coords2i chunk = chunks[i];
+                if (isGenerated[chunk.x][chunk.y])
+                {
+                    continue;
+                }
+
+                bool isRetried = false;
+                for (int radius = 1; radius <= maxChunkRetryRadius && !isRetried; ++radius)
+                {
+                    const Coords2i first(std::max(chunk.x - radius, 0), std::max(chunk.y - radius, 0));
+                    const Coords2i last(std::min(chunk.x + radius + 1, numChunks.width), std::min(chunk.y + radius + 1, numChunks.height));
+                    const WaveSeedType retrySeed = util::mixSeed(seed, radius * numChunks.total() + chunk.x * numChunks.height + chunk.y);
+                    if (!generateChunks<WaveT>(waveValues, isGenerated, first, last, phase, retrySeed))
+                    {
+                        continue;
+                    }
+
+                    // failed chunks of this phase in the block were generated too
+                    for (int cx = first.x; cx < last.x; ++cx)
+                    {
+                        for (int cy = first.y; cy < last.y; ++cy)
+                        {
+                            isGenerated[cx][cy] = isGenerated[cx][cy] || chunkPhaseOf(Coords2i(cx, cy)) == phase;
+                        }
+                    }
+                    isRetried = true;
+                }
+
+                if (!isRetried)
+                {
+                    return std::nullopt;
+                }
+            }
+        }
+
+        return this->decodeOutput(waveValues);
+    }
+
+    // generates the chunks in [first, last) of waveValues together and keeps the ones of phases up to `phase`,
+    // later ones are only a free margin. Cells of generated chunks around them are pinned in a margin.
+    // returns false if every try ended with a contradiction
+    template <typename WaveT>
+    [[nodiscard]] bool generateChunks(Array2<int>& waveValues, const Array2<bool>& isGenerated, Coords2i first, Coords2i last, int phase, WaveSeedType seed) const
+    {
+        const Size2i waveSize = waveValues.size();
+        const Size2i chunkSize = this->chunkSize();
+        const int margin = std::min({ chunkMarginWidth, chunkSize.width, chunkSize.height });
+
+        const auto chunkOf = [chunkSize](Coords2i pos) {
+            return Coords2i(pos.x / chunkSize.width, pos.y / chunkSize.height);
+        };
+        const auto isInside = [first, last](Coords2i chunk) {
+            return chunk.x >= first.x && chunk.y >= first.y && chunk.x < last.x && chunk.y < last.y;
+        };
+        const Coords2i begin(
+            std::max(first.x * chunkSize.width - margin, 0),
+            std::max(first.y * chunkSize.height - margin, 0)
+        );
+        const Coords2i end(
+            std::min(last.x * chunkSize.width + margin, waveSize.width),
+            std::min(last.y * chunkSize.height + margin, waveSize.height)
+        );
+
+        Array2<int> partial(Size2i(end.x - begin.x, end.y - begin.y), -1);
+        for (int x = begin.x; x < end.x; ++x)
+        {
+            for (int y = begin.y; y < end.y; ++y)
+            {
+                const Coords2i chunk = chunkOf({ x, y });
+                if (!isInside(chunk) && isGenerated[chunk.x][chunk.y])
+                {
+                    partial[x - begin.x][y - begin.y] = waveValues[x][y];
+                }
+            }
+        }
+
+        const std::optional<Array2<int>> completed = completeWaveValuesImpl<WaveT>(seed, partial, this->maxChunkTries(), WrappingMode::None, begin);
+        if (!completed.has_value())
+        {
+            return false;
+        }
+
+        for (int x = std::max(begin.x, first.x * chunkSize.width); x < std::min(end.x, last.x * chunkSize.width); ++x)
+        {
+            for (int y = std::max(begin.y, first.y * chunkSize.height); y < std::min(end.y, last.y * chunkSize.height); ++y)
+            {
+                if (chunkPhaseOf(chunkOf({ x, y })) <= phase)
+                {
+                    waveValues[x][y] = completed.value()[x - begin.x][y - begin.y];
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // the element whose cells are at the wave cell `pos` of `output`, -1 if there is none
+    [[nodiscard]] int elementAt(const Array2<CellType>& output, Coords2i pos) const
+    {
+        const Coords2i first = outputCellOf(pos);
+        const Size2i outputSize = output.size();
+        for (int elementId = 0; elementId < m_patterns.size(); ++elementId)
+        {
+            const auto& pattern = m_patterns.element(elementId);
+            const int patternSize = pattern.size();
+
+            bool isEqual = true;
+            for (int x = 0; x < patternSize && isEqual; ++x)
+            {
+                for (int y = 0; y < patternSize && isEqual; ++y)
+                {
+                    isEqual = pattern[x][y] == output[(first.x + x) % outputSize.width][(first.y + y) % outputSize.height];
+                }
+            }
+
+            if (isEqual)
+            {
+                return elementId;
+            }
+        }
+
+        return -1;
+    }
+
+    // writes all cells of `output` covered by the element `elementId` at the wave cell `pos`
+    // the parts overlapping the neighbours are the same as theirs
+    void placeElement(Array2<CellType>& output, Coords2i pos, int elementId) const
+    {
+        const Coords2i first = outputCellOf(pos);
+        const Size2i outputSize = output.size();
+        const auto& pattern = m_patterns.element(elementId);
+        const int patternSize = pattern.size();
+        for (int x = 0; x < patternSize; ++x)
+        {
+            for (int y = 0; y < patternSize; ++y)
+            {
+                output[(first.x + x) % outputSize.width][(first.y + y) % outputSize.height] = pattern[x][y];
+            }
+        }
+    }
+
+    [[nodiscard]] bool isChunked() const
+    {
+        const Size2i waveSize = this->waveSize();
+        const Size2i chunkSize = this->chunkSize();
+        return
+            chunkSize.width > 0 && chunkSize.height > 0
+            && (chunkSize.width < waveSize.width || chunkSize.height < waveSize.height);
+    }
+
+    // masks out the cells of `wave`, which starts at the wave cell `origin`, as in mask()
+    // positions outside of the whole wave wrap around it
+    template <typename WaveT>
+    void applyMask(WaveT& wave, Coords2i origin) const
+    {
+        const Array2<bool>& mask = this->mask();
+        if (mask.size().total() == 0)
+        {
+            return;
+        }
+
+        const Size2i size = wave.size();
+        if (origin == Coords2i(0, 0) && size == mask.size())
+        {
+            wave.setMask(mask);
+            return;
+        }
+
+        Array2<bool> subMask(size);
+        for (int x = 0; x < size.width; ++x)
+        {
+            for (int y = 0; y < size.height; ++y)
+            {
+                subMask[x][y] = !isMaskedOut(origin + Coords2i(x, y));
+            }
+        }
+        wave.setMask(subMask);
+    }
+
+    // whether the wave cell `pos` is masked out by mask(), `pos` wraps around the wave
+    [[nodiscard]] bool isMaskedOut(Coords2i pos) const
+    {
+        const Array2<bool>& mask = this->mask();
+        if (mask.size().total() == 0)
+        {
+            return false;
+        }
+
+        const Size2i size = mask.size();
+        return !mask[(pos.x % size.width + size.width) % size.width][(pos.y % size.height + size.height) % size.height];
+    }
+
+    // restricts the cells of `wave`, which starts at the wave cell `origin`, and propagates once
+    template <typename WaveT>
+    void applyConstraints(WaveT& wave, Coords2i origin) const
+    {
+        const Size2i size = wave.size();
+        for (const CellConstraint& constraint : m_constraints)
+        {
+            const Coords2i pos = constraint.pos - origin;
+            if (pos.x >= 0 && pos.y >= 0 && pos.x < size.width && pos.y < size.height && !wave.isMaskedOut(pos))
+            {
+                wave.restrictTo(pos, constraint.allowedElements);
+            }
+        }
+
+        wave.propagate();
+    }
+
+    // when `origin` is given the constraints and the mask are applied with the wave starting there
+    template <typename WaveT>
+    [[nodiscard]] std::optional<Array2<int>> completeWaveValuesImpl(WaveSeedType seed, const Array2<int>& partial, int maxTries, WrappingMode wrapping, std::optional<Coords2i> origin) const
+    {
+        const Size2i size = partial.size();
+        std::vector<int> pinned(1);
+
+        for (int i = 0; i < maxTries; ++i)
+        {
+            WaveT& wave = wavePool<WaveT>().acquire(m_compatibile, util::mixSeed(seed, i), size, m_patterns, wrapping, this->propagationEngine(), this->observationHeuristic(), this->randomNumberMode());
+            wave.setMaxBacktracks(this->maxBacktracks());
+            if (origin.has_value())
+            {
+                applyMask(wave, origin.value());
+            }
+
+            // the known cells are pinned without propagating, then everything is propagated once
+            for (int x = 0; x < size.width; ++x)
+            {
+                for (int y = 0; y < size.height; ++y)
+                {
+                    if (partial[x][y] >= 0)
+                    {
+                        pinned[0] = partial[x][y];
+                        wave.restrictTo({ x, y }, pinned);
+                    }
+                }
+            }
+
+            if (origin.has_value() && !m_constraints.empty())
+            {
+                applyConstraints(wave, origin.value());
+            }
+            else
+            {
+                wave.propagate();
+            }
+
+            // doesn't depend on the seed, so no other try can succeed
+            if (wave.hasContradiction())
+            {
+                return std::nullopt;
+            }
+
+            for (;;)
+            {
+                const auto result = wave.observeOnce();
+                if (result == WaveT::ObservationResult::Contradiction)
+                {
+                    break;
+                }
+
+                if (result == WaveT::ObservationResult::Finished)
+                {
+                    return wave.probeAll();
+                }
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    template <typename WaveT>
+    [[nodiscard]] std::optional<Array2<CellType>> nextImpl(WaveSeedType seed)
+    {
+        WaveT& wave = wavePool<WaveT>().acquire(m_compatibile, seed, this->waveSize(), m_patterns, this->outputWrapping(), this->propagationEngine(), this->observationHeuristic(), this->randomNumberMode());
+        applyMask(wave, Coords2i(0, 0));
+        if (m_constrainedWave != nullptr)
+        {
+            wave.assignCells(*std::static_pointer_cast<const WaveT>(m_constrainedWave));
+        }
+        wave.setMaxBacktracks(this->maxBacktracks());
+
+        for (;;)
+        {
+            switch (wave.observeOnce())
+            {
+            case WaveT::ObservationResult::Contradiction:
+                return std::nullopt;
+            case WaveT::ObservationResult::Finished:
+                return this->decodeOutput(wave.probeAll());
+            default:
+                continue;
+            }
+        }
+    }
+
+    // m_compatibile(elementId, dir) contains all elements that
     // can be placed next to element with id `elementId` in the `dir` direction
     CompatibilityArrayType m_compatibile;
 
     Patterns<CellType> m_patterns;
 
+    std::vector<CellConstraint> m_constraints;
+
+    // m_constraints applied to a whole wave, null when there are none or the output is chunked
+    // the wave type is given by the number of patterns and the entropy queue backend so it never changes
+    std::shared_ptr<const void> m_constrainedWave;
+
     std::mt19937_64 m_rng;
 };
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iterator>
 #include <vector>
 
@@ -14,6 +17,17 @@ struct NormalizedFrequencies
     using iterator = typename FrequenciesType::iterator;
     using const_iterator = typename FrequenciesType::const_iterator;
 
+    // frequencies and plogps in fixed point, sums of them are exact
+    // so they don't depend on the order of additions
+    using FixedPointType = std::int64_t;
+    using FixedPointValuesType = std::vector<FixedPointType>;
+    using fixed_point_const_iterator = typename FixedPointValuesType::const_iterator;
+
+    static constexpr int numFixedPointFractionBits = 32;
+
+    // value of the least significant bit
+    static constexpr double fixedPointScale = 1.0 / static_cast<double>(FixedPointType(1) << numFixedPointFractionBits);
+
     NormalizedFrequencies() = default;
     NormalizedFrequencies(const NormalizedFrequencies&) = default;
     NormalizedFrequencies(NormalizedFrequencies&&) = default;
@@ -41,6 +55,16 @@ struct NormalizedFrequencies
         return m_plogps[i];
     }
 
+    [[nodiscard]] const FixedPointValuesType& fixedPointFrequencies() const
+    {
+        return m_fixedPointFrequencies;
+    }
+
+    [[nodiscard]] const FixedPointValuesType& fixedPointPlogps() const
+    {
+        return m_fixedPointPlogps;
+    }
+
     [[nodiscard]] int size() const
     {
         return static_cast<int>(m_frequencies.size());
@@ -50,11 +74,35 @@ struct NormalizedFrequencies
     {
         m_frequencies.reserve(n);
         m_plogps.reserve(n);
+        m_fixedPointFrequencies.reserve(n);
+        m_fixedPointPlogps.reserve(n);
     }
 
 protected:
     FrequenciesType m_frequencies;
     FrequenciesType m_plogps;
+    FixedPointValuesType m_fixedPointFrequencies;
+    FixedPointValuesType m_fixedPointPlogps;
+
+    // has to be called after m_frequencies and m_plogps are filled
+    // the rounding is exact so it's the same everywhere
+    void initFixedPoint()
+    {
+        const double invScale = 1.0 / fixedPointScale;
+
+        m_fixedPointFrequencies.clear();
+        for (float f : m_frequencies)
+        {
+            // every element keeps a non zero weight
+            m_fixedPointFrequencies.emplace_back(std::max(std::llround(f * invScale), 1ll));
+        }
+
+        m_fixedPointPlogps.clear();
+        for (float plogp : m_plogps)
+        {
+            m_fixedPointPlogps.emplace_back(std::llround(plogp * invScale));
+        }
+    }
 };
 
 template <typename ElementT>
@@ -98,6 +146,8 @@ struct NormalizedHistogram : public NormalizedFrequencies
         {
             m_plogps.emplace_back(f * util::approximateLog(f));
         }
+
+        initFixedPoint();
     }
 
     [[nodiscard]] const ElementType& element(int i) const
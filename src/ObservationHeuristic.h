@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+// decides which cell is observed next
+enum struct ObservationHeuristic : std::uint8_t
+{
+    // the first undecided cell in the order of flat indices
+    // doesn't maintain any queue, works well for many tiled sets
+    Scanline,
+
+    // the cell with the least available elements
+    // ties are broken by a random noise smaller than 1, no logarithms are computed
+    MinimumRemainingValues,
+
+    // the cell with the lowest Shannon entropy plus a small random noise
+    Entropy,
+
+    // like Entropy but only cells next to decided cells are considered
+    // so the output grows from the first observed cell
+    // a new random cell is chosen when there are none
+    FrontierGrowth
+};
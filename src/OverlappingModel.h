@@ -1,16 +1,23 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <map>
+#include <utility>
 #include <vector>
 
 #include "lib/pcg_random.hpp"
 
 #include "Array2.h"
+#include "CompatibilityTable.h"
 #include "D4Symmetry.h"
+#include "EntropyQueueBackend.h"
 #include "Logger.h"
 #include "Model.h"
 #include "NormalizedHistogram.h"
+#include "ObservationHeuristic.h"
+#include "PropagationEngine.h"
+#include "RandomNumberMode.h"
 #include "Size2.h"
 #include "SmallVector.h"
 #include "WrappingMode.h"
@@ -23,6 +30,7 @@ struct OverlappingModelOptions
     static constexpr Size2i defaultOutputSize = { 32, 32 };
     static constexpr Size2i defaultStride = { 1, 1 };
     static constexpr int defaultPatternSize = 3;
+    static constexpr int defaultMaxChunkTries = 10;
 
     WrappingMode inputWrapping;
     WrappingMode outputWrapping;
@@ -35,6 +43,27 @@ struct OverlappingModelOptions
     // increasing it speeds up observation process but may produce more artifacts
     Size2i stride;
     SeedType seed;
+    PropagationEngine propagationEngine;
+    EntropyQueueBackend entropyQueueBackend;
+    ObservationHeuristic observationHeuristic;
+    RandomNumberMode randomNumberMode;
+
+    // when not {0, 0} the wave is generated in chunks of this size
+    // allows very large outputs but the output doesn't wrap
+    Size2i chunkSize;
+    int maxChunkTries;
+
+    // when positive contradictions are resolved by undoing observations
+    // instead of failing the whole try, at most this many times per try
+    int maxBacktracks;
+
+    // when not empty only the wave cells where it's true are generated, it has to be waveSize() large.
+    // Masked out cells are like cells outside of the output, so the output can have any shape
+    // and the work only depends on the number of active cells. Output cells not covered
+    // by a pattern of an active cell are left default constructed. Active cells that are not
+    // connected through active cells don't constrain each other, where their patterns overlap
+    // the one decoded later is kept
+    Array2<bool> mask;
 
     OverlappingModelOptions() :
         inputWrapping(WrappingMode::None),
@@ -44,11 +73,31 @@ struct OverlappingModelOptions
         outputSize(defaultOutputSize),
         equalFrequencies(false),
         stride(defaultStride),
-        seed(123)
+        seed(123),
+        propagationEngine(PropagationEngine::SupportCounting),
+        entropyQueueBackend(EntropyQueueBackend::Tree),
+        observationHeuristic(ObservationHeuristic::Entropy),
+        randomNumberMode(RandomNumberMode::Sequential),
+        chunkSize(0, 0),
+        maxChunkTries(defaultMaxChunkTries),
+        maxBacktracks(0),
+        mask()
     {
 
     }
 
+    // the axes on which every cell has neighbours on both sides
+    // chunked outputs don't wrap, see chunkSize, and masked out cells are like borders
+    [[nodiscard]] WrappingMode effectiveOutputWrapping() const
+    {
+        const Size2i s = waveSize();
+        const bool isChunked =
+            chunkSize.width > 0 && chunkSize.height > 0
+            && (chunkSize.width < s.width || chunkSize.height < s.height);
+        const bool isMasked = std::find(std::begin(mask), std::end(mask), false) != std::end(mask);
+        return isChunked || isMasked ? WrappingMode::None : outputWrapping;
+    }
+
     [[nodiscard]] Size2i waveSize() const
     {
         const Size2i s = waveSizeUnstrided();
@@ -121,6 +170,54 @@ struct OverlappingModelOptions
         return *this;
     }
 
+    OverlappingModelOptions& withPropagationEngine(PropagationEngine engine)
+    {
+        propagationEngine = engine;
+        return *this;
+    }
+
+    OverlappingModelOptions& withEntropyQueueBackend(EntropyQueueBackend backend)
+    {
+        entropyQueueBackend = backend;
+        return *this;
+    }
+
+    OverlappingModelOptions& withObservationHeuristic(ObservationHeuristic heuristic)
+    {
+        observationHeuristic = heuristic;
+        return *this;
+    }
+
+    OverlappingModelOptions& withRandomNumberMode(RandomNumberMode mode)
+    {
+        randomNumberMode = mode;
+        return *this;
+    }
+
+    OverlappingModelOptions& withChunkSize(Size2i size)
+    {
+        chunkSize = size;
+        return *this;
+    }
+
+    OverlappingModelOptions& withMaxChunkTries(int tries)
+    {
+        maxChunkTries = tries;
+        return *this;
+    }
+
+    OverlappingModelOptions& withMaxBacktracks(int count)
+    {
+        maxBacktracks = count;
+        return *this;
+    }
+
+    OverlappingModelOptions& withMask(Array2<bool> m)
+    {
+        mask = std::move(m);
+        return *this;
+    }
+
 private:
     [[nodiscard]] constexpr static int ceilToMultiple(int v, int m)
     {
@@ -153,7 +250,7 @@ struct OverlappingModel : Model<CellTypeT>
 
     OverlappingModel(const Array2<CellType>& input, const OptionsType& options) :
         // let's hope the compiler will call gatherPatterns only once
-        BaseType(gatherPatterns(input, options), computeCompatibilities(input, options), options.seed),
+        BaseType(gatherPatterns(input, options), computeCompatibilities(input, options), options.effectiveOutputWrapping(), options.seed),
         m_options(options)
     {
         LOG_INFO(g_logger, "Created overlapping model");
@@ -164,23 +261,37 @@ struct OverlappingModel : Model<CellTypeT>
         return m_options;
     }
 
+    [[nodiscard]] Array2<CellType> decodeCells(const Array2<int>& waveValues) const override
+    {
+        const Size2i waveSize = waveValues.size();
+
+        Array2<CellType> out(Size2i(waveSize.width * m_options.stride.width, waveSize.height * m_options.stride.height));
+
+        decodeCellsInto(waveValues, out);
+
+        return out;
+    }
+
 private:
     OptionsType m_options;
 
-    [[nodiscard]] Array2<CellType> decodeOutput(Wave&& wave) const override
+    // fill places where we only need to read one value from the pattern
+    void decodeCellsInto(const Array2<int>& waveValues, Array2<CellType>& out) const
     {
-        const Array2<int> waveValues = wave.probeAll();
         const Size2i waveSize = waveValues.size();
 
         auto [sx, sy] = m_options.stride;
 
-        Array2<CellType> out(m_options.outputSize);
-
-        // fill places where we only need to read one value from the pattern
         for (int x = 0; x < waveSize.width; ++x)
         {
             for (int y = 0; y < waveSize.height; ++y)
             {
+                // masked out
+                if (waveValues[x][y] < 0)
+                {
+                    continue;
+                }
+
                 const auto& pattern = this->patterns().element(waveValues[x][y]);
                 for (int xx = 0; xx < sx; ++xx)
                 {
@@ -191,6 +302,53 @@ private:
                 }
             }
         }
+    }
+
+    // every active cell writes its whole pattern, wrapped to the output
+    // so the cells next to masked out cells are filled too
+    void decodeMaskedInto(const Array2<int>& waveValues, Array2<CellType>& out) const
+    {
+        const Size2i waveSize = waveValues.size();
+        const Size2i outputSize = out.size();
+
+        auto [sx, sy] = m_options.stride;
+
+        for (int x = 0; x < waveSize.width; ++x)
+        {
+            for (int y = 0; y < waveSize.height; ++y)
+            {
+                if (waveValues[x][y] < 0)
+                {
+                    continue;
+                }
+
+                const auto& pattern = this->patterns().element(waveValues[x][y]);
+                for (int xx = 0; xx < m_options.patternSize; ++xx)
+                {
+                    for (int yy = 0; yy < m_options.patternSize; ++yy)
+                    {
+                        out[(x * sx + xx) % outputSize.width][(y * sy + yy) % outputSize.height] = pattern[xx][yy];
+                    }
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] Array2<CellType> decodeOutput(const Array2<int>& waveValues) const override
+    {
+        const Size2i waveSize = waveValues.size();
+
+        auto [sx, sy] = m_options.stride;
+
+        Array2<CellType> out(m_options.outputSize);
+
+        if (m_options.mask.size().total() != 0)
+        {
+            decodeMaskedInto(waveValues, out);
+            return out;
+        }
+
+        decodeCellsInto(waveValues, out);
 
         if (!contains(m_options.outputWrapping, WrappingMode::Horizontal))
         {
@@ -240,6 +398,11 @@ private:
         return out;
     }
 
+    [[nodiscard]] Coords2i outputCellOf(Coords2i pos) const override
+    {
+        return { pos.x * m_options.stride.width, pos.y * m_options.stride.height };
+    }
+
     [[nodiscard]] Size2i waveSize() const override
     {
         return m_options.waveSize();
@@ -250,7 +413,49 @@ private:
         return m_options.outputWrapping;
     }
 
+    [[nodiscard]] PropagationEngine propagationEngine() const override
+    {
+        return m_options.propagationEngine;
+    }
+
+    [[nodiscard]] EntropyQueueBackend entropyQueueBackend() const override
+    {
+        return m_options.entropyQueueBackend;
+    }
+
+    [[nodiscard]] ObservationHeuristic observationHeuristic() const override
+    {
+        return m_options.observationHeuristic;
+    }
+
+    [[nodiscard]] RandomNumberMode randomNumberMode() const override
+    {
+        return m_options.randomNumberMode;
+    }
+
+    [[nodiscard]] Size2i chunkSize() const override
+    {
+        return m_options.chunkSize;
+    }
+
+    [[nodiscard]] int maxChunkTries() const override
+    {
+        return m_options.maxChunkTries;
+    }
+
+    [[nodiscard]] int maxBacktracks() const override
+    {
+        return m_options.maxBacktracks;
+    }
+
+    [[nodiscard]] const Array2<bool>& mask() const override
+    {
+        return m_options.mask;
+    }
+
     // precomputed pattern adjacency compatibilities using overlapEqualWhenOffset
+    // j placed next to i in dir is the same as i placed next to j in the opposite dir
+    // so each unordered pair of patterns is tested only in one order
     [[nodiscard]] static CompatibilityArrayType computeCompatibilities(const Array2<CellType>& input, const OptionsType& options)
     {
         const auto patterns = gatherPatterns(input, options);
@@ -259,7 +464,7 @@ private:
 
         const int numPatterns = patterns.size();
 
-        CompatibilityArrayType compatibilities(numPatterns);
+        CompatibilityTableBuilder compatibilities(numPatterns);
 
         for (int i = 0; i < numPatterns; ++i)
         {
@@ -271,20 +476,20 @@ private:
                     dirOffset.y * options.stride.height
                 };
 
-                for (int j = 0; j < numPatterns; ++j)
+                for (int j = i; j < numPatterns; ++j)
                 {
                     const auto& pattern1 = patterns.element(i);
                     const auto& pattern2 = patterns.element(j);
 
                     if (overlapEqualWhenOffset(pattern1, pattern2, offset))
                     {
-                        compatibilities[i][dir].emplace_back(j);
+                        compatibilities.add(i, dir, j);
                     }
                 }
             }
         }
 
-        return compatibilities;
+        return std::move(compatibilities).build();
     }
 
     [[nodiscard]] static Patterns<CellType> gatherPatterns(const Array2<CellType>& input, const OptionsType& options)
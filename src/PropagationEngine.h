@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+enum struct PropagationEngine : std::uint8_t
+{
+    // AC-4 style, keeps the number of supporting elements
+    // for every (x, y, element, direction)
+    // work is proportional to the number of removed supports
+    SupportCounting,
+
+    // same counters as SupportCounting but removals are accumulated per cell
+    // and each neighbour is visited once per batch with all removed elements
+    // so that updates of its counters stay in cache
+    // better when cells tend to lose many elements at once
+    GroupedSupportCounting,
+
+    // same counters as SupportCounting, the frontier is processed one level at a time
+    // on ThreadPool::instance(), each worker owns the cells it updates so no atomics are needed
+    // the result is the same for every number of threads
+    // only pays off for large waves
+    ParallelSupportCounting,
+
+    // AC-3 style, recomputes neighbour domains from precomputed
+    // per element, per direction support bitmasks
+    // keeps no counters, cheap when the number of elements is small
+    Bitset
+};
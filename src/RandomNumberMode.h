@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// where the random numbers used by the wave come from
+enum struct RandomNumberMode : std::uint8_t
+{
+    // one generator consumed in the order in which the wave asks for numbers
+    // so the output depends on the order of memo updates
+    Sequential,
+
+    // every number is a hash of the seed, the cell it's drawn for,
+    // and the number of observations made so far
+    // so with any observation heuristic and entropy queue backend the output doesn't depend
+    // on the order in which cells are processed, the support counting engines give the same outputs.
+    // PropagationEngine::Bitset may differ when an element has no compatibile element
+    // in some direction, it removes such elements next to changed cells and support counting doesn't
+    CounterBased
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WFC_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WFC_SIMD_SSE2
+#endif
+
+#include "Util.h"
+
+namespace simd
+{
+    // for every i in [0, count) increments counters[ids[i]] by one
+    // and calls onLimit(ids[i]) for each counter that became equal to limits[ids[i]].
+    // onLimit is called in ascending order of i, after all counters of the batch
+    // containing i were written, so it may freely modify counters of already visited ids.
+    // ids must not contain duplicates.
+    template <typename CounterT, typename FuncT>
+    void incrementAndCollectLimitReached(CounterT* counters, const CounterT* limits, const std::uint16_t* ids, int count, FuncT&& onLimit)
+    {
+        static_assert(std::is_integral_v<CounterT> && sizeof(CounterT) <= sizeof(std::int32_t));
+
+        int i = 0;
+
+#if defined(WFC_SIMD_AVX2)
+        if constexpr (sizeof(CounterT) == sizeof(std::int32_t))
+        {
+            const __m256i ones = _mm256_set1_epi32(1);
+            for (; i + 8 <= count; i += 8)
+            {
+                // ids are zero extended to the 32 bit indices the gather needs
+                const __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i)));
+                const __m256i c = _mm256_add_epi32(_mm256_i32gather_epi32(reinterpret_cast<const int*>(counters), idx, 4), ones);
+                const __m256i l = _mm256_i32gather_epi32(reinterpret_cast<const int*>(limits), idx, 4);
+
+                // there is no scatter in AVX2
+                alignas(32) std::int32_t incremented[8];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(incremented), c);
+                for (int j = 0; j < 8; ++j)
+                {
+                    counters[ids[i + j]] = static_cast<CounterT>(incremented[j]);
+                }
+
+                unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(c, l))));
+                while (mask)
+                {
+                    onLimit(ids[i + util::findFirstSet(mask)]);
+                    mask &= mask - 1;
+                }
+            }
+        }
+#endif
+
+#if defined(WFC_SIMD_AVX2) || defined(WFC_SIMD_SSE2)
+        // no gather for narrow counters (nor at all in SSE2)
+        // so only the arithmetic and the limit test are vectorized
+        {
+            const __m128i ones = _mm_set1_epi32(1);
+            for (; i + 4 <= count; i += 4)
+            {
+                const int id0 = ids[i + 0];
+                const int id1 = ids[i + 1];
+                const int id2 = ids[i + 2];
+                const int id3 = ids[i + 3];
+
+                const __m128i c = _mm_add_epi32(_mm_set_epi32(counters[id3], counters[id2], counters[id1], counters[id0]), ones);
+                const __m128i l = _mm_set_epi32(limits[id3], limits[id2], limits[id1], limits[id0]);
+
+                alignas(16) std::int32_t incremented[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(incremented), c);
+                counters[id0] = static_cast<CounterT>(incremented[0]);
+                counters[id1] = static_cast<CounterT>(incremented[1]);
+                counters[id2] = static_cast<CounterT>(incremented[2]);
+                counters[id3] = static_cast<CounterT>(incremented[3]);
+
+                unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c, l))));
+                while (mask)
+                {
+                    onLimit(ids[i + util::findFirstSet(mask)]);
+                    mask &= mask - 1;
+                }
+            }
+        }
+#endif
+
+        // scalar tail, also the whole kernel when no SIMD is available
+        for (; i < count; ++i)
+        {
+            CounterT& c = counters[ids[i]];
+            c += 1;
+            if (c == limits[ids[i]])
+            {
+                onLimit(ids[i]);
+            }
+        }
+    }
+
+    // sum of weights[i] over every set bit i of mask
+    // only the first `count` weights are read, mask must not have bits at or above count
+    // the additions are always done in the same order, whatever instruction set is used,
+    // so the result is the same bit for bit: there are 8 partial sums, the l-th one
+    // takes bits l, l + 8, l + 16, ... in ascending order and they are added as
+    // ((s0 + s4) + (s2 + s6)) + ((s1 + s5) + (s3 + s7)).
+    // Weights must not be negative. Bytes of the mask with no bits set are skipped.
+    [[nodiscard]] inline float maskedSum(const float* weights, std::uint64_t mask, int count)
+    {
+        int chunk = 0;
+        alignas(32) float partial[8] = {};
+
+#if defined(WFC_SIMD_AVX2)
+        {
+            const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            __m256 acc = _mm256_setzero_ps();
+            for (; chunk * 8 + 8 <= count; ++chunk)
+            {
+                const int byte = static_cast<int>((mask >> (chunk * 8)) & 0xFF);
+                if (byte == 0)
+                {
+                    continue;
+                }
+
+                const __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), laneBits), laneBits);
+                acc = _mm256_add_ps(acc, _mm256_and_ps(_mm256_loadu_ps(weights + chunk * 8), _mm256_castsi256_ps(lanes)));
+            }
+            _mm256_store_ps(partial, acc);
+        }
+#elif defined(WFC_SIMD_SSE2)
+        {
+            const __m128i loLaneBits = _mm_setr_epi32(1, 2, 4, 8);
+            const __m128i hiLaneBits = _mm_setr_epi32(16, 32, 64, 128);
+            __m128 lo = _mm_setzero_ps();
+            __m128 hi = _mm_setzero_ps();
+            for (; chunk * 8 + 8 <= count; ++chunk)
+            {
+                const int byte = static_cast<int>((mask >> (chunk * 8)) & 0xFF);
+                if (byte == 0)
+                {
+                    continue;
+                }
+
+                const __m128i b = _mm_set1_epi32(byte);
+                const __m128i loLanes = _mm_cmpeq_epi32(_mm_and_si128(b, loLaneBits), loLaneBits);
+                const __m128i hiLanes = _mm_cmpeq_epi32(_mm_and_si128(b, hiLaneBits), hiLaneBits);
+                lo = _mm_add_ps(lo, _mm_and_ps(_mm_loadu_ps(weights + chunk * 8), _mm_castsi128_ps(loLanes)));
+                hi = _mm_add_ps(hi, _mm_and_ps(_mm_loadu_ps(weights + chunk * 8 + 4), _mm_castsi128_ps(hiLanes)));
+            }
+            _mm_store_ps(partial, lo);
+            _mm_store_ps(partial + 4, hi);
+        }
+#endif
+
+        // scalar tail, also the whole kernel when no SIMD is available
+        // a skipped lane would add +0.0f, which doesn't change a non negative sum
+        for (std::uint64_t rest = chunk * 8 < 64 ? mask >> (chunk * 8) : 0; rest; rest &= rest - 1)
+        {
+            const int i = chunk * 8 + util::findFirstSet(rest);
+            partial[i % 8] += weights[i];
+        }
+
+        return ((partial[0] + partial[4]) + (partial[2] + partial[6])) + ((partial[1] + partial[5]) + (partial[3] + partial[7]));
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iterator>
+#include <utility>
 
 template <typename IterT>
 struct IterSpan
@@ -47,3 +48,6 @@ private:
     IterT m_begin;
     IterT m_end;
 };
+
+template <typename ContainerT>
+IterSpan(ContainerT&&) -> IterSpan<decltype(std::begin(std::declval<ContainerT&>()))>;
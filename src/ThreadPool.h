@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads for fork-join style loops
+// the calling thread takes part in the work too
+struct ThreadPool
+{
+    // numThreads includes the calling thread
+    explicit ThreadPool(int numThreads) :
+        m_job(nullptr),
+        m_generation(0),
+        m_numBusyWorkers(0),
+        m_isStopping(false)
+    {
+        for (int i = 1; i < numThreads; ++i)
+        {
+            m_workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_isStopping = true;
+        }
+        m_workAvailable.notify_all();
+
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    // shared by everything that doesn't need a dedicated pool
+    [[nodiscard]] static ThreadPool& instance()
+    {
+        static ThreadPool pool(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+        return pool;
+    }
+
+    [[nodiscard]] int numThreads() const
+    {
+        return static_cast<int>(m_workers.size()) + 1;
+    }
+
+    // calls func(begin, end) for disjoint ranges of at most grainSize elements covering [0, count)
+    // returns when all of them are done
+    // when the pool is already busy with another loop everything is done on the calling thread
+    template <typename FuncT>
+    void parallelFor(int count, int grainSize, FuncT&& func)
+    {
+        std::unique_lock<std::mutex> dispatchLock(m_dispatchMutex, std::try_to_lock);
+        if (count <= grainSize || m_workers.empty() || !dispatchLock.owns_lock())
+        {
+            if (count > 0)
+            {
+                func(0, count);
+            }
+            return;
+        }
+
+        std::atomic<int> next = 0;
+        const std::function<void()> job = [&next, count, grainSize, &func]() {
+            for (;;)
+            {
+                const int begin = next.fetch_add(grainSize);
+                if (begin >= count)
+                {
+                    break;
+                }
+
+                func(begin, std::min(begin + grainSize, count));
+            }
+        };
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_numBusyWorkers = static_cast<int>(m_workers.size());
+            ++m_generation;
+        }
+        m_workAvailable.notify_all();
+
+        job();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_workDone.wait(lock, [this]() { return m_numBusyWorkers == 0; });
+        m_job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> m_workers;
+
+    // serializes parallelFor calls
+    std::mutex m_dispatchMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_workDone;
+    const std::function<void()>* m_job;
+    std::uint64_t m_generation;
+    int m_numBusyWorkers;
+    bool m_isStopping;
+
+    void workerLoop()
+    {
+        std::uint64_t lastGeneration = 0;
+        for (;;)
+        {
+            const std::function<void()>* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_workAvailable.wait(lock, [this, lastGeneration]() { return m_isStopping || m_generation != lastGeneration; });
+                if (m_isStopping)
+                {
+                    return;
+                }
+
+                lastGeneration = m_generation;
+                job = m_job;
+            }
+
+            (*job)();
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                --m_numBusyWorkers;
+            }
+            m_workDone.notify_one();
+        }
+    }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <map>
 #include <utility>
@@ -8,10 +9,15 @@
 #include "lib/pcg_random.hpp"
 
 #include "Array2.h"
+#include "CompatibilityTable.h"
 #include "D4Symmetry.h"
+#include "EntropyQueueBackend.h"
 #include "Logger.h"
 #include "Model.h"
 #include "NormalizedHistogram.h"
+#include "ObservationHeuristic.h"
+#include "PropagationEngine.h"
+#include "RandomNumberMode.h"
 #include "Size2.h"
 #include "SmallVector.h"
 #include "WrappingMode.h"
@@ -22,19 +28,59 @@ struct TiledModelOptions
     using SeedType = typename Model<CellTypeT>::ModelSeedType;
 
     static constexpr Size2i defaultOutputSize = { 32, 32 };
+    static constexpr int defaultMaxChunkTries = 10;
 
     WrappingMode outputWrapping;
     Size2i outputSize;
     SeedType seed;
+    PropagationEngine propagationEngine;
+    EntropyQueueBackend entropyQueueBackend;
+    ObservationHeuristic observationHeuristic;
+    RandomNumberMode randomNumberMode;
+
+    // when not {0, 0} the wave is generated in chunks of this size
+    // allows very large outputs but the output doesn't wrap
+    Size2i chunkSize;
+    int maxChunkTries;
+
+    // when positive contradictions are resolved by undoing observations
+    // instead of failing the whole try, at most this many times per try
+    int maxBacktracks;
+
+    // when not empty only the cells where it's true are generated, it has to be outputSize large.
+    // Masked out cells are like cells outside of the output, so the output can have any shape
+    // and the work only depends on the number of active cells. Tiles of masked out cells
+    // are left default constructed
+    Array2<bool> mask;
 
     TiledModelOptions() :
         outputWrapping(WrappingMode::None),
         outputSize(defaultOutputSize),
-        seed(123)
+        seed(123),
+        propagationEngine(PropagationEngine::SupportCounting),
+        entropyQueueBackend(EntropyQueueBackend::Tree),
+        observationHeuristic(ObservationHeuristic::Entropy),
+        randomNumberMode(RandomNumberMode::Sequential),
+        chunkSize(0, 0),
+        maxChunkTries(defaultMaxChunkTries),
+        maxBacktracks(0),
+        mask()
     {
 
     }
 
+    // the axes on which every cell has neighbours on both sides
+    // chunked outputs don't wrap, see chunkSize, and masked out cells are like borders
+    [[nodiscard]] WrappingMode effectiveOutputWrapping() const
+    {
+        const Size2i s = waveSize();
+        const bool isChunked =
+            chunkSize.width > 0 && chunkSize.height > 0
+            && (chunkSize.width < s.width || chunkSize.height < s.height);
+        const bool isMasked = std::find(std::begin(mask), std::end(mask), false) != std::end(mask);
+        return isChunked || isMasked ? WrappingMode::None : outputWrapping;
+    }
+
     [[nodiscard]] Size2i waveSize() const
     {
         return outputSize;
@@ -51,6 +97,54 @@ struct TiledModelOptions
         outputWrapping = mode;
         return *this;
     }
+
+    TiledModelOptions& withPropagationEngine(PropagationEngine engine)
+    {
+        propagationEngine = engine;
+        return *this;
+    }
+
+    TiledModelOptions& withEntropyQueueBackend(EntropyQueueBackend backend)
+    {
+        entropyQueueBackend = backend;
+        return *this;
+    }
+
+    TiledModelOptions& withObservationHeuristic(ObservationHeuristic heuristic)
+    {
+        observationHeuristic = heuristic;
+        return *this;
+    }
+
+    TiledModelOptions& withRandomNumberMode(RandomNumberMode mode)
+    {
+        randomNumberMode = mode;
+        return *this;
+    }
+
+    TiledModelOptions& withChunkSize(Size2i size)
+    {
+        chunkSize = size;
+        return *this;
+    }
+
+    TiledModelOptions& withMaxChunkTries(int tries)
+    {
+        maxChunkTries = tries;
+        return *this;
+    }
+
+    TiledModelOptions& withMaxBacktracks(int count)
+    {
+        maxBacktracks = count;
+        return *this;
+    }
+
+    TiledModelOptions& withMask(Array2<bool> m)
+    {
+        mask = std::move(m);
+        return *this;
+    }
 };
 
 template <typename CellTypeT>
@@ -65,7 +159,7 @@ struct TiledModel : Model<CellTypeT>
     using OptionsType = TiledModelOptions<CellType>;
 
     TiledModel(const TileSetType& tiles, const OptionsType& options) :
-        BaseType(flattenPatterns(tiles), computeCompatibilities(tiles), options.seed),
+        BaseType(flattenPatterns(tiles), computeCompatibilities(tiles), options.effectiveOutputWrapping(), options.seed),
         m_options(options)
     {
         LOG_INFO(g_logger, "Created tiled model");
@@ -76,22 +170,24 @@ struct TiledModel : Model<CellTypeT>
         return m_options;
     }
 
-private:
-    OptionsType m_options;
-
-    [[nodiscard]] Array2<CellType> decodeOutput(Wave&& wave) const override
+    [[nodiscard]] Array2<CellType> decodeCells(const Array2<int>& waveValues) const override
     {
-        const Array2<int> waveValues = wave.probeAll();
         const Size2i waveSize = waveValues.size();
 
         const int tileSize = this->patterns().element(0).size();
 
-        Array2<CellType> out(m_options.outputSize * tileSize);
+        Array2<CellType> out(waveSize * tileSize);
 
         for (int x = 0; x < waveSize.width; ++x)
         {
             for (int y = 0; y < waveSize.height; ++y)
             {
+                // masked out
+                if (waveValues[x][y] < 0)
+                {
+                    continue;
+                }
+
                 const auto& pattern = this->patterns().element(waveValues[x][y]);
 
                 for (int xx = 0; xx < tileSize; ++xx)
@@ -107,6 +203,21 @@ private:
         return out;
     }
 
+private:
+    OptionsType m_options;
+
+    [[nodiscard]] Array2<CellType> decodeOutput(const Array2<int>& waveValues) const override
+    {
+        // wave size is the output size so there's nothing more to it
+        return decodeCells(waveValues);
+    }
+
+    [[nodiscard]] Coords2i outputCellOf(Coords2i pos) const override
+    {
+        const int tileSize = this->patterns().element(0).size();
+        return { pos.x * tileSize, pos.y * tileSize };
+    }
+
     [[nodiscard]] Size2i waveSize() const override
     {
         return m_options.waveSize();
@@ -117,6 +228,46 @@ private:
         return m_options.outputWrapping;
     }
 
+    [[nodiscard]] PropagationEngine propagationEngine() const override
+    {
+        return m_options.propagationEngine;
+    }
+
+    [[nodiscard]] EntropyQueueBackend entropyQueueBackend() const override
+    {
+        return m_options.entropyQueueBackend;
+    }
+
+    [[nodiscard]] ObservationHeuristic observationHeuristic() const override
+    {
+        return m_options.observationHeuristic;
+    }
+
+    [[nodiscard]] RandomNumberMode randomNumberMode() const override
+    {
+        return m_options.randomNumberMode;
+    }
+
+    [[nodiscard]] Size2i chunkSize() const override
+    {
+        return m_options.chunkSize;
+    }
+
+    [[nodiscard]] int maxChunkTries() const override
+    {
+        return m_options.maxChunkTries;
+    }
+
+    [[nodiscard]] int maxBacktracks() const override
+    {
+        return m_options.maxBacktracks;
+    }
+
+    [[nodiscard]] const Array2<bool>& mask() const override
+    {
+        return m_options.mask;
+    }
+
     [[nodiscard]] static Patterns<CellType> flattenPatterns(const TileSetType& tiles)
     {
         std::vector<PatternsEntryType> patterns;
@@ -146,7 +297,7 @@ private:
             numPatterns += tile.numDistinct();
         }
 
-        CompatibilityArrayType compatibilities(numPatterns);
+        CompatibilityTableBuilder compatibilities(numPatterns);
 
         const int numTiles = tiles.size();
         for (int firstTileId = 0; firstTileId < numTiles; ++firstTileId)
@@ -169,8 +320,7 @@ private:
                                 const int firstPatternId = flattenedIndex[firstTileId] + i;
                                 const int secondPatternId = flattenedIndex[secondTileId] + j;
 
-                                compatibilities[firstPatternId][connectionDir].emplace_back(secondPatternId);
-                                compatibilities[secondPatternId][oppositeTo(connectionDir)].emplace_back(firstPatternId);
+                                compatibilities.add(firstPatternId, connectionDir, secondPatternId);
                             }
                         }
 
@@ -182,7 +332,8 @@ private:
             }
         }
 
-        return compatibilities;
+        // pairs within the same tile are visited from both sides, the builder removes the duplicates
+        return std::move(compatibilities).build();
     }
 
     [[nodiscard]] static bool areSidesCompatibile(const TileSetType& tiles, const TileType& firstTile, D4Symmetry firstTransform, const TileType& secondTile, D4Symmetry secondTransform, Direction connectionDir)
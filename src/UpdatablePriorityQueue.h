@@ -57,7 +57,8 @@ struct UpdatablePriorityQueue : private CompT
         m_maxSize(0),
         m_nextNode(0),
         m_root(nullptr),
-        m_values(std::make_unique<UninitializedNode[]>(capacity))
+        // no value initialization, nodes are constructed on insertion
+        m_values(new UninitializedNode[capacity])
     {
         m_rebuildTreeTemporaryNodeStorage.reserve(capacity);
     }
@@ -70,7 +71,8 @@ struct UpdatablePriorityQueue : private CompT
         m_nextNode(other.m_nextNode),
         m_root(other.m_root),
         m_values(std::move(other.m_values)),
-        m_rebuildTreeTemporaryNodeStorage(std::move(other.m_rebuildTreeTemporaryNodeStorage))
+        m_rebuildTreeTemporaryNodeStorage(std::move(other.m_rebuildTreeTemporaryNodeStorage)),
+        m_freeNodes(std::move(other.m_freeNodes))
     {
         other.m_root = nullptr;
     }
@@ -87,6 +89,7 @@ struct UpdatablePriorityQueue : private CompT
         m_nextNode = other.m_nextNode;
         m_values = std::move(other.m_values);
         m_root = other.m_root;
+        m_freeNodes = std::move(other.m_freeNodes);
 
         other.m_root = nullptr;
 
@@ -139,13 +142,13 @@ struct UpdatablePriorityQueue : private CompT
 
         eraseNoDestroy(node);
         destroyNode(node);
+        m_freeNodes.emplace_back(node);
     }
 
     template <typename... ArgsTs>
     [[nodiscard]] Node* emplace(ArgsTs&& ... args)
     {
-        assert(m_nextNode < m_capacity);
-        Node* node = createNode(m_nextNode++, std::forward<ArgsTs>(args)...);
+        Node* node = createNode(std::forward<ArgsTs>(args)...);
         insert(node);
         return node;
     }
@@ -153,12 +156,22 @@ struct UpdatablePriorityQueue : private CompT
     template <typename U>
     [[nodiscard]] Node* push(U&& value)
     {
-        assert(m_nextNode < m_capacity);
-        Node* node = createNode(m_nextNode++, std::forward<U>(value));
+        Node* node = createNode(std::forward<U>(value));
         insert(node);
         return node;
     }
 
+    // removes all elements but keeps the node storage
+    void clear()
+    {
+        cleanup(m_root);
+        m_root = nullptr;
+        m_size = 0;
+        m_maxSize = 0;
+        m_nextNode = 0;
+        m_freeNodes.clear();
+    }
+
     [[nodiscard]] bool empty() const
     {
         return m_size == 0;
@@ -183,10 +196,24 @@ private:
     std::unique_ptr<UninitializedNode[]> m_values;
     std::vector<Node*> m_rebuildTreeTemporaryNodeStorage;
 
+    // storage of erased nodes, reused before the never used storage
+    // so that the capacity only bounds the number of elements at once
+    std::vector<Node*> m_freeNodes;
+
     template <typename... ArgsTs>
-    [[nodiscard]] Node* createNode(int i, ArgsTs&& ... args)
+    [[nodiscard]] Node* createNode(ArgsTs&& ... args)
     {
-        Node* ptr = reinterpret_cast<Node*>(&(m_values[i]));
+        Node* ptr = nullptr;
+        if (!m_freeNodes.empty())
+        {
+            ptr = m_freeNodes.back();
+            m_freeNodes.pop_back();
+        }
+        else
+        {
+            assert(m_nextNode < m_capacity);
+            ptr = reinterpret_cast<Node*>(&(m_values[m_nextNode++]));
+        }
         new (ptr) Node(std::forward<ArgsTs>(args)...);
         return ptr;
     }
@@ -226,31 +253,53 @@ private:
         }
     }
 
+    // the order has to hold with the in-order neighbours,
+    // checking only the parent and the children misses the ancestors further up
     [[nodiscard]] bool isWellPlaced(Node* node)
     {
-        if (node->left != nullptr && !compare(*(node->left), *node))
+        const Node* prev = predecessor(node);
+        if (prev != nullptr && !compare(*prev, *node))
         {
             return false;
         }
 
-        if (node->right != nullptr && !compare(*node, *(node->right)))
+        const Node* next = successor(node);
+        if (next != nullptr && !compare(*node, *next))
         {
             return false;
         }
 
-        if (node->parent != nullptr)
+        return true;
+    }
+
+    [[nodiscard]] Node* predecessor(Node* node)
+    {
+        if (node->left != nullptr)
         {
-            if (node->parent->left == node && !compare(*node, *(node->parent)))
-            {
-                return false;
-            }
-            else if(!compare(*(node->parent), *node))
-            {
-                return false;
-            }
+            return maxNode(node->left);
         }
 
-        return true;
+        while (node->parent != nullptr && node->parent->left == node)
+        {
+            node = node->parent;
+        }
+
+        return node->parent;
+    }
+
+    [[nodiscard]] Node* successor(Node* node)
+    {
+        if (node->right != nullptr)
+        {
+            return minNode(node->right);
+        }
+
+        while (node->parent != nullptr && node->parent->right == node)
+        {
+            node = node->parent;
+        }
+
+        return node->parent;
     }
 
     [[nodiscard]] Node* minNode(Node* node)
@@ -263,6 +312,16 @@ private:
         return node;
     }
 
+    [[nodiscard]] Node* maxNode(Node* node)
+    {
+        while (node->right != nullptr)
+        {
+            node = node->right;
+        }
+
+        return node;
+    }
+
     [[nodiscard]] Node* minNode()
     {
         return minNode(m_root);
@@ -3,6 +3,10 @@
 #include <cstdint>
 #include <cstring>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace util
 {
     template <typename T>
@@ -31,4 +35,47 @@ namespace util
     {
         return static_cast<float>(approximateLog(static_cast<double>(a)));
     }
+
+    [[nodiscard]] inline int popcount(std::uint64_t v)
+    {
+#if defined(_MSC_VER)
+        return static_cast<int>(__popcnt64(v));
+#else
+        return __builtin_popcountll(v);
+#endif
+    }
+
+    // index of the least significant set bit
+    // v must not be 0
+    [[nodiscard]] inline int findFirstSet(std::uint64_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward64(&idx, v);
+        return static_cast<int>(idx);
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+
+    // derives an independent seed from `seed` and `v`
+    // splitmix64 finalizer, so close inputs give unrelated outputs
+    [[nodiscard]] constexpr std::uint64_t mixSeed(std::uint64_t seed, std::uint64_t v)
+    {
+        std::uint64_t z = seed + (v + 1) * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // calls func(bitIndex) for every set bit, in ascending order
+    template <typename FuncT>
+    void forEachSetBit(std::uint64_t v, FuncT&& func)
+    {
+        while (v)
+        {
+            func(findFirstSet(v));
+            v &= v - 1;
+        }
+    }
 }
@@ -1,101 +1,113 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cassert>
 #include <cmath>
 #include <execution>
 #include <iterator>
+#include <limits>
 #include <optional>
-#include <queue>
 #include <random>
+#include <type_traits>
+#include <variant>
 
 #include "lib/pcg_random.hpp"
 
 #include "Array2.h"
 #include "Array3.h"
+#include "BitArray3.h"
+#include "CompatibilityTable.h"
 #include "Direction.h"
+#include "EntropyQueue.h"
 #include "Logger.h"
 #include "NormalizedHistogram.h"
+#include "ObservationHeuristic.h"
+#include "PropagationEngine.h"
+#include "RandomNumberMode.h"
+#include "Simd.h"
 #include "Span.h"
-#include "UpdatablePriorityQueue.h"
+#include "ThreadPool.h"
 #include "Util.h"
 
 // INFO: const sometimes ommited with structured bindings due to clang bug
 //       https://bugs.llvm.org/show_bug.cgi?id=33236
 
-// hard to tell which one is better.
-// using updatable priority queue should have more deterministic memory consumption
-#define USE_UPDATABLE_PRIORITY_QUEUE
-
-struct Wave
+// NumWordsV is the number of 64 bit words used for the domain of each cell
+// 0 means that it's decided at runtime from the number of elements
+// otherwise it's a compile time constant and the wave supports at most NumWordsV * 64 elements
+// EntropyQueueT orders touched cells by entropy, see EntropyQueue.h
+template <int NumWordsV = 0, typename EntropyQueueT = TreeEntropyQueue>
+struct BasicWave
 {
+    using DomainType = BitArray3<NumWordsV>;
+    using DomainWordType = typename DomainType::WordType;
     using RandomNumberGeneratorType = pcg32_fast;
-    using CompatibilityArrayType = std::vector<ByDirection<std::vector<int>>>;
-    using CompatibilityElementIterator = typename CompatibilityArrayType::const_iterator;
+    using CompatibilityArrayType = CompatibilityTable;
     using FrequencyIterator = typename NormalizedFrequencies::const_iterator;
+    using FixedPointType = typename NormalizedFrequencies::FixedPointType;
+    using FixedPointIterator = typename NormalizedFrequencies::fixed_point_const_iterator;
 
 private:
-    struct EntropyQueueEntry
-    {
-        float entropy;
-
-        int index;
-
-        [[nodiscard]] friend bool operator<(EntropyQueueEntry lhs, EntropyQueueEntry rhs) noexcept
-        {
-            return lhs.entropy < rhs.entropy;
-        }
+    using EntropyQueueType = EntropyQueueT;
 
-        [[nodiscard]] friend bool operator>(EntropyQueueEntry lhs, EntropyQueueEntry rhs) noexcept
-        {
-            return !(operator<(lhs, rhs));
-        }
-    };
-
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-    using EntropyQueueType = UpdatablePriorityQueue<EntropyQueueEntry>;
-    using EntropyQueueNodeHandle = typename EntropyQueueType::NodeHandle;
-    static constexpr EntropyQueueNodeHandle invalidNodeHandle{};
-
-    struct MemoEntry
+    // sums over the available elements of a cell
+    // in fixed point, see NormalizedFrequencies, so they are exact and don't depend on the order of removals
+    struct EntropySums
     {
         // sum { p'(element) * log(p'(element)) }
-        float plogpSum;
+        FixedPointType plogpSum;
 
         // sum { p'(element) }
-        float pSum;
+        FixedPointType pSum;
+    };
 
+    // state of the memo of a cell before the first modification after a decision
+    struct MemoSnapshot
+    {
+        int index;
+        EntropySums sums;
         int numAvailableElements;
-
         float entropy;
-
-        bool needsUpdate = false;
-
-        EntropyQueueNodeHandle iter = invalidNodeHandle;
     };
-#else
-    using EntropyQueueType = std::priority_queue<EntropyQueueEntry, std::vector<EntropyQueueEntry>, std::greater<>>;
 
-    struct MemoEntry
+    struct Removal
     {
-        // sum { p'(element) * log(p'(element)) }
-        float plogpSum;
-
-        // sum { p'(element) }
-        float pSum;
+        int cellIdx;
+        int elementId;
+    };
 
-        int numAvailableElements;
+    struct Decision
+    {
+        Coords2i pos;
+        int elementId;
 
-        float entropy;
+        // sizes of the trails and m_touchedCells from before the decision
+        int removalTrailSize;
+        int memoTrailSize;
+        int numTouchedCells;
 
-        bool needsUpdate = false;
+        int scanlineCursor;
     };
-#endif
 
     static_assert(std::decay_t<RandomNumberGeneratorType>::min() == 0);
     static constexpr float rngMax = static_cast<float>(std::decay_t<RandomNumberGeneratorType>::max());
 
+    // what the numbers drawn in RandomNumberMode::CounterBased are used for
+    enum struct RandomStream : std::uint64_t
+    {
+        Noise,
+        Sample
+    };
+
     RandomNumberGeneratorType m_rng;
 
+    // RandomNumberMode::CounterBased draws from m_seed instead of m_rng
+    std::uint64_t m_seed;
+
+    // number of observations made since the last reset, the counter for RandomNumberMode::CounterBased
+    std::uint32_t m_step;
+
     Size2i m_size;
 
     // min { (p * log(p)) / 2 }
@@ -103,9 +115,16 @@ private:
 
     WrappingMode m_wrapping;
 
+    PropagationEngine m_propagationEngine;
+
+    ObservationHeuristic m_observationHeuristic;
+
+    RandomNumberMode m_randomNumberMode;
+
     bool m_hasContradiction;
 
-    IterSpan<CompatibilityElementIterator> m_compatibile;
+    // the table is owned by the model
+    CompatibilityArrayType::View m_compatibile;
 
     // p
     IterSpan<FrequencyIterator> m_p;
@@ -113,432 +132,1536 @@ private:
     // p * log(p)
     IterSpan<FrequencyIterator> m_plogp;
 
-    MemoEntry m_initEntry;
+    // p and p * log(p) in fixed point
+    IterSpan<FixedPointIterator> m_fixedP;
+    IterSpan<FixedPointIterator> m_fixedPlogp;
+
+    // one cell worth of domain words
+    using CellWordsType = std::conditional_t<
+        DomainType::hasFixedNumWordsPerCell,
+        std::array<DomainWordType, std::max(NumWordsV, 1)>,
+        std::vector<DomainWordType>
+    >;
+
+    template <typename CounterT>
+    struct SupportCounters
+    {
+        // numSupports[dir * numElements() + elementId]
+        // denotes the number of elements that can be placed
+        // at ((x, y) + opposite(dir)) without contradiction with (x, y)
+        // when nothing is removed yet. It's the same for every cell.
+        std::vector<CounterT> numSupports;
+
+        // numRemoved[{x, y, dir * numElements() + elementId}]
+        // denotes how many of these supports were removed since the start
+        // the element is unsupported when it reaches numSupports
+        // zero for cells that were not touched yet
+        // direction-major so that counters updated by a single propagateTo are contiguous
+        Array3<CounterT> numRemoved;
+    };
+
+    // the narrowest counter type that can hold the longest compatibility list is used
+    using NumCompatibileArrayType = std::variant<
+        SupportCounters<std::uint8_t>,
+        SupportCounters<std::uint16_t>,
+        SupportCounters<std::int32_t>
+    >;
+
+    // state of every cell that was not touched yet
+    EntropySums m_initSums;
+    float m_initEntropy;
+
+    // the memo of each cell is split into arrays indexed by the flat index of the cell
+    // so that each pass only streams the fields it uses
+    // only meaningful for touched cells, they get the initial state on the first touch
+
+    // read by every removal, contradiction check and queue update
+    std::vector<std::int32_t> m_numAvailableElements;
+
+    // m_memoNeedsUpdate[i] is 1 iff cell i is in m_pendingMemoUpdates
+    std::vector<std::uint8_t> m_memoNeedsUpdate;
+
+    // only maintained when the heuristic uses entropy, see usesEntropySums()
+    std::vector<EntropySums> m_entropySums;
+
+    // the priority in the entropy queue, lower is observed first, see queueKey
+    std::vector<float> m_entropies;
+
+    // m_isRemoved[{x, y, elementId}] is set iff elementId can no longer be placed at (x, y)
+    // one bit per element, packed into whole words for each (x, y)
+    // all zeros means that everything can be placed so it starts as a zeroed allocation
+    DomainType m_isRemoved;
+
+    // bits set for every valid element id, one cell worth of words
+    CellWordsType m_elementMask;
+
+    NumCompatibileArrayType m_numCompatibile;
 
-    Array2<MemoEntry> m_memo;
+    // flat indices of cells that differ from the initial state
+    // allows reset() to only revisit what was modified
+    std::vector<int> m_touchedCells;
 
-    // m_canBePlaced[x][y][elementId]
-    Array3<bool> m_canBePlaced;
+    // bit i is set iff cell with flat index i is in m_touchedCells
+    std::vector<DomainWordType> m_isCellTouched;
 
-    // m_numCompatibile[{x, y, elementId}][dir]
-    // denotes the number of elements in the wave that can be placed
-    // at ((x, y) + opposite(dir)) without contradiction with (x, y)
-    // if m_canBePlaced[x][y][elementId] == false then
-    // m_numCompatibile[{x, y, elementId}][dir] <= 0 for every dir
-    Array3<ByDirection<int>> m_numCompatibile;
+    // bit i is set iff cell with flat index i is masked out, see setMask
+    // empty when there is no mask
+    std::vector<DomainWordType> m_isCellMaskedOut;
+
+    // number of cells that are not masked out
+    int m_numActiveCells;
 
     // each elements holds {x, y, elementId}
+    // only used with PropagationEngine::SupportCounting
     std::vector<Coords3i> m_propagationQueue;
 
+    // m_supportMasks[(elementId * 4 + dir) * m_isRemoved.numWordsPerCell() + wordId]
+    // has bits set for elements that can be placed next to `elementId` in the `dir` direction
+    // only used with PropagationEngine::Bitset
+    std::vector<DomainWordType> m_supportMasks;
+
+    // cells whose domain shrunk and whose neighbours have to be revisited
+    // not used with PropagationEngine::SupportCounting
+    std::vector<Coords2i> m_dirtyCells;
+
+    // m_isCellDirty[{x, y}] is true iff {x, y} is in m_dirtyCells
+    // PropagationEngine::ParallelSupportCounting also uses it to mark m_targetCells
+    Array2<bool> m_isCellDirty;
+
+    // m_pendingRemovals[{x, y, elementId}] is set iff elementId was removed from (x, y)
+    // but the removal was not yet propagated to the neighbours
+    // only used with grouped and parallel support counting, empty otherwise
+    DomainType m_pendingRemovals;
+
+    // removals found during the current level, they become m_pendingRemovals for the next one
+    // only used with PropagationEngine::ParallelSupportCounting, empty otherwise
+    DomainType m_nextPendingRemovals;
+
+    // neighbours of the current level, each one is updated by a single worker
+    // only used with PropagationEngine::ParallelSupportCounting
+    std::vector<Coords2i> m_targetCells;
+
+    // one cell worth of words for temporary use
+    CellWordsType m_cellScratch;
+
+    // sum of the frequencies of the available elements in each word of the observed cell
+    std::conditional_t<
+        DomainType::hasFixedNumWordsPerCell,
+        std::array<float, std::max(NumWordsV, 1)>,
+        std::vector<float>
+    > m_wordWeights;
+
     EntropyQueueType m_entropyQueue;
 
     std::vector<int> m_pendingMemoUpdates;
 
-    [[nodiscard]] Array3<ByDirection<int>> initNumCompatibile() const
+    // every cell with a lower flat index is decided
+    // used by ObservationHeuristic::Scanline and as a fallback by ObservationHeuristic::FrontierGrowth
+    int m_scanlineCursor;
+
+    // bit i is set iff cell with flat index i has a decided neighbour, such cells are always touched
+    // only used with ObservationHeuristic::FrontierGrowth, empty otherwise
+    std::vector<DomainWordType> m_isFrontier;
+
+    // 0 disables backtracking, then nothing below is used
+    int m_maxBacktracks;
+    int m_numBacktracks;
+
+    // observations that can still be undone, the last one is the most recent
+    std::vector<Decision> m_decisions;
+
+    // every removal since the first decision, in order
+    std::vector<Removal> m_removalTrail;
+
+    std::vector<MemoSnapshot> m_memoTrail;
+
+    // m_memoStamps[i] == m_trailStamp iff memo i was already saved (or first touched)
+    // since the last change of the decision stack, so it will be restored properly
+    std::vector<std::uint32_t> m_memoStamps;
+    std::uint32_t m_trailStamp;
+
+    void initEntropy()
     {
-        /*const*/ auto [width, height] = size();
+        m_noiseMax = std::numeric_limits<float>::max();
+        for (auto&& plogp : m_plogp)
+        {
+            m_noiseMax = std::min(m_noiseMax, std::abs(plogp));
+        }
+        m_noiseMax *= 0.5f;
+
+        FixedPointType basePlogpSum = 0;
+        for (auto&& plogp : m_fixedPlogp)
+        {
+            basePlogpSum += plogp;
+        }
+
+        FixedPointType basePSum = 0;
+        for (auto&& p : m_fixedP)
+        {
+            basePSum += p;
+        }
+
+        // cells are only materialized when touched, until then they share this
+        m_initSums = EntropySums{ basePlogpSum, basePSum };
+        m_initEntropy = m_observationHeuristic == ObservationHeuristic::MinimumRemainingValues
+            ? static_cast<float>(numElements())
+            : entropyOf(m_initSums);
+    }
+
+    // without noise
+    // only integer to double conversions and basic double arithmetic
+    // so it's the same everywhere for the same sums
+    [[nodiscard]] static float entropyOf(const EntropySums& sums)
+    {
+        const double pSum = static_cast<double>(sums.pSum);
+        return static_cast<float>(util::approximateLog(pSum * NormalizedFrequencies::fixedPointScale) - static_cast<double>(sums.plogpSum) / pSum);
+    }
+
+    [[nodiscard]] bool usesEntropySums() const
+    {
+        return m_observationHeuristic == ObservationHeuristic::Entropy
+            || m_observationHeuristic == ObservationHeuristic::FrontierGrowth;
+    }
+
+    // column-major, the same order as in Array2
+    [[nodiscard]] int flatIndex(Coords2i pos) const
+    {
+        return pos.x * m_size.height + pos.y;
+    }
+
+    [[nodiscard]] Coords2i coordsFromFlatIndex(int i) const
+    {
+        return { i / m_size.height, i % m_size.height };
+    }
+
+    void initFrontier()
+    {
+        const std::size_t frontierSize = m_observationHeuristic == ObservationHeuristic::FrontierGrowth ? m_isCellTouched.size() : 0;
+        if (m_isFrontier.size() != frontierSize)
+        {
+            m_isFrontier.assign(frontierSize, 0);
+        }
+    }
+
+    [[nodiscard]] bool usesEntropyQueue() const
+    {
+        return m_observationHeuristic != ObservationHeuristic::Scanline;
+    }
+
+    [[nodiscard]] bool usesSupportCounters() const
+    {
+        return m_propagationEngine == PropagationEngine::SupportCounting
+            || m_propagationEngine == PropagationEngine::GroupedSupportCounting
+            || m_propagationEngine == PropagationEngine::ParallelSupportCounting;
+    }
+
+    [[nodiscard]] bool usesPendingRemovals() const
+    {
+        return m_propagationEngine == PropagationEngine::GroupedSupportCounting
+            || m_propagationEngine == PropagationEngine::ParallelSupportCounting;
+    }
+
+    void initPendingRemovals()
+    {
+        const Size3i emptySize(0, 0, 0);
+
+        const Size3i pendingSize = usesPendingRemovals() ? m_isRemoved.size() : emptySize;
+        if (m_pendingRemovals.size() != pendingSize)
+        {
+            m_pendingRemovals = DomainType(pendingSize, false);
+        }
+
+        const Size3i nextPendingSize = m_propagationEngine == PropagationEngine::ParallelSupportCounting ? m_isRemoved.size() : emptySize;
+        if (m_nextPendingRemovals.size() != nextPendingSize)
+        {
+            m_nextPendingRemovals = DomainType(nextPendingSize, false);
+        }
+    }
+
+    void initNumCompatibile()
+    {
+        if (!usesSupportCounters())
+        {
+            m_numCompatibile = {};
+            return;
+        }
+
         const int ne = numElements();
 
-        Array3<ByDirection<int>> res({ width, height, ne });
+        // the same for every cell
+        std::vector<int> cellCounts(cardinality<Direction>() * ne);
+        for (Direction dir : values<Direction>())
+        {
+            for (int elementId = 0; elementId < ne; ++elementId)
+            {
+                cellCounts[toId(dir) * ne + elementId] = static_cast<int>(m_compatibile(elementId, oppositeTo(dir)).size());
+            }
+        }
+
+        const int maxCount = cellCounts.empty() ? 0 : *std::max_element(std::begin(cellCounts), std::end(cellCounts));
+        if (maxCount <= std::numeric_limits<std::uint8_t>::max())
+        {
+            initNumCompatibile<std::uint8_t>(cellCounts);
+        }
+        else if (maxCount <= std::numeric_limits<std::uint16_t>::max())
+        {
+            initNumCompatibile<std::uint16_t>(cellCounts);
+        }
+        else
+        {
+            initNumCompatibile<std::int32_t>(cellCounts);
+        }
+    }
+
+    template <typename CounterT>
+    void initNumCompatibile(const std::vector<int>& cellCounts)
+    {
+        std::vector<CounterT> numSupports(std::begin(cellCounts), std::end(cellCounts));
+        const Size3i countersSize(size(), static_cast<int>(cellCounts.size()));
+
+        // counters are all zero outside of a generation so the storage can be kept
+        auto* counters = std::get_if<SupportCounters<CounterT>>(&m_numCompatibile);
+        if (counters != nullptr && counters->numRemoved.size() == countersSize)
+        {
+            counters->numSupports = std::move(numSupports);
+        }
+        else
+        {
+            m_numCompatibile = SupportCounters<CounterT>{ std::move(numSupports), Array3<CounterT>(countersSize, 0) };
+        }
+    }
+
+    [[nodiscard]] CellWordsType initElementMask() const
+    {
+        CellWordsType res{};
+        if constexpr (!DomainType::hasFixedNumWordsPerCell)
+        {
+            res.resize(m_isRemoved.numWordsPerCell());
+        }
+
+        for (int elementId = 0; elementId < numElements(); ++elementId)
+        {
+            res[elementId / DomainType::bitsPerWord] |= DomainType::bitMask(elementId);
+        }
+
+        return res;
+    }
+
+    [[nodiscard]] std::vector<DomainWordType> initSupportMasks() const
+    {
+        if (m_propagationEngine != PropagationEngine::Bitset)
+        {
+            return {};
+        }
 
-        forEach(res, [&](ByDirection<int>& r, int x, int y, int elementId) {
-            const auto& compatibile = m_compatibile[elementId];
+        const int ne = numElements();
+        const int numWords = m_isRemoved.numWordsPerCell();
 
+        std::vector<DomainWordType> res(ne * cardinality<Direction>() * numWords, 0);
+        for (int elementId = 0; elementId < ne; ++elementId)
+        {
             for (Direction dir : values<Direction>())
             {
-                r[dir] = static_cast<int>(compatibile[oppositeTo(dir)].size());
+                auto* mask = res.data() + (elementId * cardinality<Direction>() + toId(dir)) * numWords;
+                for (const int compatibileElementId : m_compatibile(elementId, dir))
+                {
+                    mask[compatibileElementId / DomainType::bitsPerWord] |= DomainType::bitMask(compatibileElementId);
+                }
             }
-        });
+        }
 
         return res;
     }
 
-    [[nodiscard]] auto randomNoiseGenerator(float max)
+    // elements of the i-th word that were not removed yet
+    [[nodiscard]] DomainWordType availableWord(const DomainWordType* removed, int i) const
     {
-        auto dNoise = [scale = max * (1.0f / rngMax), this]() {
-            return m_rng() * scale;
-        };
-        return dNoise;
+        return ~removed[i] & m_elementMask[i];
     }
 
-public:
-    enum struct MinimalEntropyQueryResult
+    [[nodiscard]] bool isCellTouched(int cellIdx) const
     {
-        Success,
-        Contradiction,
-        Finished
-    };
+        return (m_isCellTouched[cellIdx / DomainType::bitsPerWord] & DomainType::bitMask(cellIdx)) != 0;
+    }
 
-    enum struct ObservationResult
+    [[nodiscard]] bool isCellMaskedOut(int cellIdx) const
     {
-        Contradiction,
-        Finished,
-        Unfinished
-    };
+        return !m_isCellMaskedOut.empty() && (m_isCellMaskedOut[cellIdx / DomainType::bitsPerWord] & DomainType::bitMask(cellIdx)) != 0;
+    }
 
-    Wave(const CompatibilityArrayType& compatibility, std::uint64_t seed, Size2i size, const NormalizedFrequencies& freq, WrappingMode wrapping) :
-        m_rng(seed),
-        m_size(size),
-        m_noiseMax(std::numeric_limits<float>::max()),
-        m_wrapping(wrapping),
-        m_hasContradiction(false),
-        m_compatibile(compatibility),
-        m_p(freq.frequencies()),
-        m_plogp(freq.plogps()),
-        m_memo(size),
-        m_canBePlaced(Size3i(size, freq.size()), true),
-        m_numCompatibile(initNumCompatibile()),
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-        m_entropyQueue(size.total())
-#endif
+    // has to be called before the first modification of the cell
+    // materializes the memo and schedules the cell to be put in the entropy queue
+    void touchCell(int cellIdx)
     {
-        for (auto&& plogp : m_plogp)
+        if (!isCellTouched(cellIdx))
         {
-            m_noiseMax = std::min(m_noiseMax, std::abs(plogp));
+            m_isCellTouched[cellIdx / DomainType::bitsPerWord] |= DomainType::bitMask(cellIdx);
+            m_touchedCells.emplace_back(cellIdx);
+
+            m_numAvailableElements[cellIdx] = numElements();
+            m_entropySums[cellIdx] = m_initSums;
+            m_entropies[cellIdx] = m_initEntropy;
+            m_memoNeedsUpdate[cellIdx] = 1;
+            m_pendingMemoUpdates.emplace_back(cellIdx);
+
+            // undoing the decision untouches the cell, there is nothing to save
+            if (!m_decisions.empty())
+            {
+                m_memoStamps[cellIdx] = m_trailStamp;
+            }
         }
-        m_noiseMax *= 0.5f;
+    }
+
+    void scheduleMemoUpdate(int cellIdx)
+    {
+        if (!m_memoNeedsUpdate[cellIdx])
+        {
+            m_memoNeedsUpdate[cellIdx] = 1;
+            m_pendingMemoUpdates.emplace_back(cellIdx);
+        }
+    }
+
+    // has to be called before every modification of the memo of a touched cell
+    void saveMemoForUndo(int cellIdx)
+    {
+        if (m_decisions.empty() || m_memoStamps[cellIdx] == m_trailStamp)
+        {
+            return;
+        }
+
+        m_memoStamps[cellIdx] = m_trailStamp;
+
+        m_memoTrail.push_back(MemoSnapshot{ cellIdx, m_entropySums[cellIdx], m_numAvailableElements[cellIdx], m_entropies[cellIdx] });
+    }
+
+    void recordRemoval(int cellIdx, int elementId)
+    {
+        if (!m_decisions.empty())
+        {
+            m_removalTrail.push_back(Removal{ cellIdx, elementId });
+        }
+    }
+
+    // puts the cell in the entropy queue, or takes it out, to match m_entropies[cellIdx]
+    // cells with at most one available element are never in the queue
+    // and with ObservationHeuristic::FrontierGrowth neither are cells outside of the frontier
+    void requeue(int cellIdx)
+    {
+        if (!usesEntropyQueue())
+        {
+            return;
+        }
+
+        const bool isQueued = m_entropyQueue.contains(cellIdx);
+        if (m_numAvailableElements[cellIdx] <= 1 || (m_observationHeuristic == ObservationHeuristic::FrontierGrowth && !isFrontier(cellIdx)))
+        {
+            if (isQueued)
+            {
+                m_entropyQueue.erase(cellIdx);
+            }
+        }
+        else if (isQueued)
+        {
+            m_entropyQueue.update(cellIdx, m_entropies[cellIdx]);
+        }
+        else
+        {
+            // first touch
+            m_entropyQueue.push(cellIdx, m_entropies[cellIdx]);
+        }
+    }
+
+    [[nodiscard]] bool isFrontier(int cellIdx) const
+    {
+        return (m_isFrontier[cellIdx / DomainType::bitsPerWord] & DomainType::bitMask(cellIdx)) != 0;
+    }
+
+    // called when the cell becomes decided, its undecided neighbours join the frontier
+    // they are touched so that they get a memo and get queued by doPendingMemoUpdates
+    void growFrontier(int cellIdx)
+    {
+        forEachNeighbour(coordsFromFlatIndex(cellIdx), [this](Coords2i neighbour) {
+            const int i = flatIndex(neighbour);
+            if (isFrontier(i))
+            {
+                return;
+            }
+
+            m_isFrontier[i / DomainType::bitsPerWord] |= DomainType::bitMask(i);
+            touchCell(i);
+            scheduleMemoUpdate(i);
+        });
+    }
+
+    // masked out cells count as decided
+    [[nodiscard]] bool isCellDecided(int cellIdx) const
+    {
+        if (isCellMaskedOut(cellIdx))
+        {
+            return true;
+        }
+
+        const int numAvailableElements = isCellTouched(cellIdx) ? m_numAvailableElements[cellIdx] : numElements();
+        return numAvailableElements <= 1;
+    }
 
-        // frequencies are normalized so
-        // base_s = 1, log(base_s) = 0
-        // simplifies the equation
+    // first undecided cell in the order of flat indices, m_size.total() if there is none
+    [[nodiscard]] int nextScanlineCell()
+    {
+        const int numCells = m_size.total();
+        while (m_scanlineCursor < numCells && isCellDecided(m_scanlineCursor))
+        {
+            ++m_scanlineCursor;
+        }
+        return m_scanlineCursor;
+    }
 
-        float baseEntropy = 0;
-        for (int i = 0; i < freq.size(); ++i) {
-            baseEntropy += m_plogp[i];
+    // untouched cells all have the same entropy (without noise)
+    // so the one with the lowest index is chosen, like the first of equal entries in the queue would be.
+    // masked out cells are skipped, there has to be at least one other untouched cell
+    [[nodiscard]] int firstUntouchedCell() const
+    {
+        const int numWords = static_cast<int>(m_isCellTouched.size());
+        for (int wordId = 0; wordId < numWords; ++wordId)
+        {
+            const DomainWordType maskedOut = m_isCellMaskedOut.empty() ? 0 : m_isCellMaskedOut[wordId];
+            const DomainWordType word = ~(m_isCellTouched[wordId] | maskedOut);
+            if (word)
+            {
+                // bits past the last cell are never set in m_isCellTouched
+                // but there is an untouched cell before them
+                return wordId * DomainType::bitsPerWord + util::findFirstSet(word);
+            }
         }
 
-        m_initEntry = MemoEntry{ baseEntropy, 1.0f, static_cast<int>(freq.size()), -baseEntropy };
-        auto dNoise = randomNoiseGenerator(m_noiseMax);
-        for (auto& e : m_memo)
-        {
-            e.entropy += dNoise();
+        assert(false);
+        return m_size.total();
+    }
+
+    [[nodiscard]] auto randomNoiseGenerator(float max)
+    {
+        auto dNoise = [scale = max * (1.0f / rngMax), this]() {
+            return m_rng() * scale;
+        };
+        return dNoise;
+    }
+
+    // a pure function of (seed, stream, step, cell), no state is consumed
+    [[nodiscard]] std::uint64_t counterBasedBits(RandomStream stream, int cellIdx) const
+    {
+        const std::uint64_t counter = (static_cast<std::uint64_t>(m_step) << 32) | static_cast<std::uint32_t>(cellIdx);
+        return util::mixSeed(util::mixSeed(m_seed, static_cast<std::uint64_t>(stream)), counter);
+    }
+
+    // uniform in [0, 1)
+    [[nodiscard]] float counterBasedUniform(RandomStream stream, int cellIdx) const
+    {
+        // 24 bits is all a float can represent exactly in [0, 1)
+        return static_cast<float>(counterBasedBits(stream, cellIdx) >> 40) * (1.0f / 16777216.0f);
+    }
+
+    // uniform in [0, max]
+    [[nodiscard]] float entropyNoise(int cellIdx, float max)
+    {
+        if (m_randomNumberMode == RandomNumberMode::CounterBased)
+        {
+            return counterBasedUniform(RandomStream::Noise, cellIdx) * max;
+        }
+
+        return randomNoiseGenerator(max)();
+    }
+
+    // the priority of a touched undecided cell in the entropy queue
+    // with ObservationHeuristic::MinimumRemainingValues the number of available elements is the bucket
+    // and the noise, less than 1, breaks the ties between cells in it
+    [[nodiscard]] float queueKey(int cellIdx)
+    {
+        if (m_observationHeuristic == ObservationHeuristic::MinimumRemainingValues)
+        {
+            return static_cast<float>(m_numAvailableElements[cellIdx]) + entropyNoise(cellIdx, 0.5f);
+        }
+
+        return entropyOf(m_entropySums[cellIdx]) + entropyNoise(cellIdx, m_noiseMax);
+    }
+
+public:
+    enum struct MinimalEntropyQueryResult
+    {
+        Success,
+        Contradiction,
+        Finished
+    };
+
+    enum struct ObservationResult
+    {
+        Contradiction,
+        Finished,
+        Unfinished
+    };
+
+    BasicWave(const CompatibilityArrayType& compatibility, std::uint64_t seed, Size2i size, const NormalizedFrequencies& freq, WrappingMode wrapping, PropagationEngine engine = PropagationEngine::SupportCounting, ObservationHeuristic heuristic = ObservationHeuristic::Entropy, RandomNumberMode randomNumberMode = RandomNumberMode::Sequential) :
+        m_rng(seed),
+        m_seed(seed),
+        m_step(0),
+        m_size(size),
+        m_noiseMax(0.0f),
+        m_wrapping(wrapping),
+        m_propagationEngine(engine),
+        m_observationHeuristic(heuristic),
+        m_randomNumberMode(randomNumberMode),
+        m_hasContradiction(false),
+        m_compatibile(compatibility.view()),
+        m_p(freq.frequencies()),
+        m_plogp(freq.plogps()),
+        m_fixedP(freq.fixedPointFrequencies()),
+        m_fixedPlogp(freq.fixedPointPlogps()),
+        m_numAvailableElements(size.total()),
+        m_memoNeedsUpdate(size.total(), 0),
+        m_entropySums(size.total()),
+        m_entropies(size.total()),
+        m_isRemoved(Size3i(size, freq.size()), false),
+        m_elementMask(initElementMask()),
+        m_isCellTouched(DomainType::numWordsFor(size.total()), 0),
+        m_numActiveCells(size.total()),
+        m_supportMasks(initSupportMasks()),
+        m_isCellDirty(size, false),
+        m_entropyQueue(size.total()),
+        m_scanlineCursor(0),
+        m_maxBacktracks(0),
+        m_numBacktracks(0),
+        m_trailStamp(0)
+    {
+        if constexpr (!DomainType::hasFixedNumWordsPerCell)
+        {
+            m_cellScratch.resize(m_isRemoved.numWordsPerCell());
+            m_wordWeights.resize(m_isRemoved.numWordsPerCell());
+        }
+
+        initNumCompatibile();
+        initPendingRemovals();
+        initFrontier();
+        initEntropy();
+
+        LOG_DEBUG(g_logger, "Created wave");
+        LOG_DEBUG(g_logger, "basePlogpSum = ", m_initSums.plogpSum);
+        LOG_DEBUG(g_logger, "numAvailableElements = ", freq.size());
+        LOG_DEBUG(g_logger, "entropy = ", m_initEntropy);
+        LOG_DEBUG(g_logger, "noiseMax = ", m_noiseMax);
+        LOG_DEBUG(g_logger, "size = (", m_size.width, ", ", m_size.height, ")");
+    }
+
+    BasicWave(const BasicWave&) = default;
+    BasicWave(BasicWave&&) = default;
+    BasicWave& operator=(const BasicWave&) = default;
+    BasicWave& operator=(BasicWave&&) = default;
+    ~BasicWave() = default;
+
+    // only the touched cells are restored, no storage is reallocated
+    void reset()
+    {
+        m_hasContradiction = false;
+
+        const int numWords = m_isRemoved.numWordsPerCell();
+        // not numElements(), the frequencies may be already gone when reset() is called by rebind()
+        const int numCounters = cardinality<Direction>() * m_isRemoved.size().depth;
+        for (int i : m_touchedCells)
+        {
+            const Coords2i pos = coordsFromFlatIndex(i);
+
+            auto* removed = m_isRemoved[pos];
+            std::fill(removed, removed + numWords, DomainWordType(0));
+
+            if (usesSupportCounters())
+            {
+                std::visit([pos, numCounters](auto& counters) {
+                    auto* numRemoved = counters.numRemoved[pos];
+                    std::fill(numRemoved, numRemoved + numCounters, 0);
+                }, m_numCompatibile);
+            }
+
+            if (usesPendingRemovals())
+            {
+                auto* pending = m_pendingRemovals[pos];
+                std::fill(pending, pending + numWords, DomainWordType(0));
+            }
+
+            if (m_propagationEngine == PropagationEngine::ParallelSupportCounting)
+            {
+                auto* nextPending = m_nextPendingRemovals[pos];
+                std::fill(nextPending, nextPending + numWords, DomainWordType(0));
+            }
+
+            m_memoNeedsUpdate[i] = 0;
+            m_isCellTouched[i / DomainType::bitsPerWord] = 0;
+            if (!m_isFrontier.empty())
+            {
+                m_isFrontier[i / DomainType::bitsPerWord] = 0;
+            }
+        }
+        m_touchedCells.clear();
+        m_scanlineCursor = 0;
+        m_step = 0;
+
+        // stamps are left as they are, m_trailStamp only grows so they are all stale
+        m_numBacktracks = 0;
+        m_decisions.clear();
+        m_removalTrail.clear();
+        m_memoTrail.clear();
+
+        m_propagationQueue.clear();
+        for (Coords2i pos : m_dirtyCells)
+        {
+            m_isCellDirty[pos] = false;
+        }
+        m_dirtyCells.clear();
+        for (Coords2i pos : m_targetCells)
+        {
+            m_isCellDirty[pos] = false;
+        }
+        m_targetCells.clear();
+        m_pendingMemoUpdates.clear();
+
+        m_entropyQueue.clear();
+    }
+
+    // same as reset() but also restarts the random number generator
+    // so that the wave behaves exactly like a newly constructed one
+    void reset(std::uint64_t seed)
+    {
+        reset();
+        m_rng = RandomNumberGeneratorType(seed);
+        m_seed = seed;
+    }
+
+    // in-place equivalent of constructing a new wave with the same size and number of elements
+    // reuses all the per cell storage, only the per element tables are recomputed
+    void rebind(const CompatibilityArrayType& compatibility, std::uint64_t seed, const NormalizedFrequencies& freq, WrappingMode wrapping, PropagationEngine engine = PropagationEngine::SupportCounting, ObservationHeuristic heuristic = ObservationHeuristic::Entropy, RandomNumberMode randomNumberMode = RandomNumberMode::Sequential)
+    {
+        assert(freq.size() == m_isRemoved.size().depth);
+
+        reset(seed);
+
+        m_wrapping = wrapping;
+        m_propagationEngine = engine;
+        m_observationHeuristic = heuristic;
+        m_randomNumberMode = randomNumberMode;
+        m_maxBacktracks = 0;
+        m_isCellMaskedOut.clear();
+        m_numActiveCells = m_size.total();
+        m_compatibile = compatibility.view();
+        m_p = freq.frequencies();
+        m_plogp = freq.plogps();
+        m_fixedP = freq.fixedPointFrequencies();
+        m_fixedPlogp = freq.fixedPointPlogps();
+
+        initNumCompatibile();
+        initPendingRemovals();
+        m_supportMasks = initSupportMasks();
+        initFrontier();
+        initEntropy();
+    }
+
+    // when positive a contradiction after an observation doesn't end the generation,
+    // instead the wave goes back to the state from before the observation and bans the chosen element.
+    // Gives up after `maxBacktracks` such steps in total, until reset.
+    // Only applies to observations made after the call.
+    void setMaxBacktracks(int maxBacktracks)
+    {
+        m_maxBacktracks = maxBacktracks;
+        if (m_maxBacktracks > 0 && static_cast<int>(m_memoStamps.size()) != m_size.total())
+        {
+            m_memoStamps.assign(m_size.total(), 0);
+        }
+    }
+
+    [[nodiscard]] int numBacktracks() const
+    {
+        return m_numBacktracks;
+    }
+
+    // cells where `isActive` is false are masked out. They are treated like cells outside of the wave,
+    // they are never touched, observed nor propagated to, so the work only depends on the active cells.
+    // An empty `isActive` removes the mask. Has to be called before any modification of the wave,
+    // reset() keeps the mask, rebind() removes it
+    void setMask(const Array2<bool>& isActive)
+    {
+        assert(m_touchedCells.empty());
+
+        if (isActive.size().total() == 0)
+        {
+            m_isCellMaskedOut.clear();
+            m_numActiveCells = m_size.total();
+            return;
+        }
+
+        assert(isActive.size() == m_size);
+
+        m_isCellMaskedOut.assign(m_isCellTouched.size(), 0);
+        m_numActiveCells = 0;
+        for (int x = 0; x < m_size.width; ++x)
+        {
+            for (int y = 0; y < m_size.height; ++y)
+            {
+                if (isActive[x][y])
+                {
+                    m_numActiveCells += 1;
+                    continue;
+                }
+
+                const int i = flatIndex({ x, y });
+                m_isCellMaskedOut[i / DomainType::bitsPerWord] |= DomainType::bitMask(i);
+            }
+        }
+    }
+
+    [[nodiscard]] bool isMaskedOut(Coords2i pos) const
+    {
+        return isCellMaskedOut(flatIndex(pos));
+    }
+
+    // a cell was left without elements by the last propagation
+    // and it could not be undone by backtracking
+    [[nodiscard]] bool hasContradiction() const
+    {
+        return m_hasContradiction;
+    }
+
+    // should only be called after whole wave is defined
+    // if everything went ok then it should always return a value
+    // -1 for masked out cells
+    [[nodiscard]] int probe(Coords2i pos) const
+    {
+        if (isMaskedOut(pos))
+        {
+            return -1;
+        }
+
+        const auto* removed = m_isRemoved[pos];
+        int elementId = -1;
+        for (int i = 0; i < m_isRemoved.numWordsPerCell(); ++i)
+        {
+            if (const auto word = availableWord(removed, i))
+            {
+                elementId = i * DomainType::bitsPerWord + util::findFirstSet(word);
+                break;
+            }
+        }
+
+        // if there is none then it means that the wave is garbage
+        // so why not return garbage
+        return std::max(elementId, 0);
+    }
+
+    [[nodiscard]] Array2<int> probeSub(Coords2i start, Size2i size) const
+    {
+        Array2<int> ids(size);
+
+        const Coords2i end = start + Coords2i{ size.width, size.height }; 
+
+        for (int x = start.x; x < end.x; ++x)
+        {
+            for (int y = start.y; y < end.y; ++y)
+            {
+                ids[x - start.x][y - start.y] = probe({ x, y });
+            }
+        }
+
+        return ids;
+    }
+
+    [[nodiscard]] Array2<int> probeAll() const
+    {
+        return probeSub({ 0, 0 }, size());
+    }
+
+    [[nodiscard]] ObservationResult observeOnce() noexcept
+    {
+        const auto [status, pos] = posWithMinimalEntropy();
+
+        if (status == MinimalEntropyQueryResult::Contradiction)
+        {
+            return ObservationResult::Contradiction;
+        }
+
+        if (status == MinimalEntropyQueryResult::Finished)
+        {
+            return ObservationResult::Finished;
+        }
+
+        LOG_DEBUG(g_logger, "Observed (", pos.x, ", ", pos.y, ")");
+
+        // choose an element according to the pattern distribution
+        // the weight of each word is summed with simd::maskedSum, empty words are skipped
+        // so the choice only depends on the seed, not on the instruction set
+        const auto* removed = m_isRemoved[pos];
+        const int numWords = m_isRemoved.numWordsPerCell();
+        const int ne = numElements();
+        const float* p = &m_p[0];
+
+        float pssum = 0.0f;
+        for (int i = 0; i < numWords; ++i)
+        {
+            const auto word = availableWord(removed, i);
+            const int base = i * DomainType::bitsPerWord;
+            m_wordWeights[i] = word ? simd::maskedSum(p + base, word, std::min(ne - base, DomainType::bitsPerWord)) : 0.0f;
+            pssum += m_wordWeights[i];
+        }
+
+        float r;
+        if (m_randomNumberMode == RandomNumberMode::CounterBased)
+        {
+            r = counterBasedUniform(RandomStream::Sample, flatIndex(pos)) * pssum;
+        }
+        else
+        {
+            std::uniform_real_distribution<float> dPssum(0.0f, pssum);
+            r = std::min(dPssum(m_rng), pssum); // min just in case of unfortunate rounding
+        }
+
+        // first placable element for which the prefix sum reaches r
+        // the word is found by the word weights, only inside of it the elements are visited
+        const int patternId = [&]() {
+            float prefixSum = 0.0f;
+            for (int i = 0; i < numWords; ++i)
+            {
+                if (m_wordWeights[i] == 0.0f || prefixSum + m_wordWeights[i] < r)
+                {
+                    prefixSum += m_wordWeights[i];
+                    continue;
+                }
+
+                int elementId = 0;
+                for (auto word = availableWord(removed, i); word; word &= word - 1)
+                {
+                    elementId = i * DomainType::bitsPerWord + util::findFirstSet(word);
+                    prefixSum += p[elementId];
+                    if (prefixSum >= r)
+                    {
+                        break;
+                    }
+                }
+
+                // the last one when the sum in a different order falls short due to rounding
+                return elementId;
+            }
+
+            // unreachable unless the cell is already in contradiction
+            return 0;
+        }();
+
+        // the noise of cells updated by this observation is drawn for the next step
+        ++m_step;
+
+        if (m_maxBacktracks > 0)
+        {
+            pushDecision(pos, patternId);
+        }
+
+        setElement(pos, patternId);
+
+        backtrackWhileContradiction();
+
+        return ObservationResult::Unfinished;
+    }
+
+    [[nodiscard]] Size2i size() const
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] int numElements() const
+    {
+        return static_cast<int>(m_plogp.size());
+    }
+
+    [[nodiscard]] bool canBePlaced(Coords2i pos, int elementId) const
+    {
+        return !m_isRemoved[{pos, elementId}];
+    }
+
+    void setElement(Coords2i pos, int elementId)
+    {
+        assert(!isMaskedOut(pos));
+
+        // define the cell with the chosen pattern by disabling others
+        makeUnplacableAllExcept(pos, elementId);
+
+        propagate();
+    }
+
+    // removes `elementId` from the cell at `pos`
+    // the removal is not propagated until the next propagate()
+    // so that many bans only need a single propagation.
+    // Bans made after an observation are undone with it when backtracking
+    void ban(Coords2i pos, int elementId)
+    {
+        assert(elementId >= 0 && elementId < numElements());
+        assert(!isMaskedOut(pos));
+
+        makeUnplacable(pos, elementId);
+    }
+
+    // ban({x, y}, elementId) for every {x, y, elementId}
+    template <typename IterT>
+    void banMany(IterSpan<IterT> bans)
+    {
+        for (const Coords3i& b : bans)
+        {
+            ban({ b.x, b.y }, b.z);
+        }
+    }
+
+    // removes every element of the cell at `pos` that is not in `allowedElementIds`
+    // not propagated either, see ban()
+    void restrictTo(Coords2i pos, const std::vector<int>& allowedElementIds)
+    {
+        assert(!isMaskedOut(pos));
+
+        const int numWords = m_isRemoved.numWordsPerCell();
+        std::fill(std::begin(m_cellScratch), std::begin(m_cellScratch) + numWords, DomainWordType(0));
+        for (const int elementId : allowedElementIds)
+        {
+            assert(elementId >= 0 && elementId < numElements());
+            m_cellScratch[elementId / DomainType::bitsPerWord] |= DomainType::bitMask(elementId);
+        }
+
+        const auto* removed = m_isRemoved[pos];
+        for (int i = 0; i < numWords; ++i)
+        {
+            const int base = i * DomainType::bitsPerWord;
+            util::forEachSetBit(availableWord(removed, i) & ~m_cellScratch[i], [&](int bit) {
+                makeUnplacable(pos, base + bit);
+            });
+        }
+    }
+
+    // makes every cell the same as in `prototype`, which has to have the same size, elements, mask and settings
+    // and no decisions. Only the cells touched in either of the waves are visited.
+    // The noise of the undecided cells is drawn again from this wave's generator
+    // so that copies of the same prototype with different seeds don't share it.
+    void assignCells(const BasicWave& prototype)
+    {
+        assert(prototype.m_size == m_size && prototype.numElements() == numElements());
+        assert(prototype.m_decisions.empty() && prototype.m_pendingMemoUpdates.empty());
+        assert(prototype.m_isCellMaskedOut == m_isCellMaskedOut);
+
+        reset();
+
+        m_hasContradiction = prototype.m_hasContradiction;
+
+        const int numWords = m_isRemoved.numWordsPerCell();
+        const int numCounters = cardinality<Direction>() * numElements();
+        for (const int i : prototype.m_touchedCells)
+        {
+            const Coords2i pos = coordsFromFlatIndex(i);
+
+            std::copy(prototype.m_isRemoved[pos], prototype.m_isRemoved[pos] + numWords, m_isRemoved[pos]);
+
+            if (usesSupportCounters())
+            {
+                std::visit([&prototype, pos, numCounters](auto& counters) {
+                    const auto& prototypeCounters = std::get<std::decay_t<decltype(counters)>>(prototype.m_numCompatibile);
+                    std::copy(prototypeCounters.numRemoved[pos], prototypeCounters.numRemoved[pos] + numCounters, counters.numRemoved[pos]);
+                }, m_numCompatibile);
+            }
+
+            m_isCellTouched[i / DomainType::bitsPerWord] |= DomainType::bitMask(i);
+            m_touchedCells.emplace_back(i);
+            if (!m_isFrontier.empty())
+            {
+                m_isFrontier[i / DomainType::bitsPerWord] |= prototype.m_isFrontier[i / DomainType::bitsPerWord] & DomainType::bitMask(i);
+            }
+
+            m_numAvailableElements[i] = prototype.m_numAvailableElements[i];
+            m_entropySums[i] = prototype.m_entropySums[i];
+            m_entropies[i] = prototype.m_entropies[i];
+            if (usesEntropyQueue() && m_numAvailableElements[i] > 1)
+            {
+                m_entropies[i] = queueKey(i);
+            }
+
+            requeue(i);
+        }
+    }
+
+    [[nodiscard]] std::pair<MinimalEntropyQueryResult, Coords2i> posWithMinimalEntropy()
+    {
+        if (m_hasContradiction)
+        {
+            // there's cannot be an unassignable element
+            return { MinimalEntropyQueryResult::Contradiction, {} };
+        }
+
+        // masked out cells are never touched
+        const bool hasUntouchedCells = static_cast<int>(m_touchedCells.size()) < m_numActiveCells;
+        switch (m_observationHeuristic)
+        {
+        case ObservationHeuristic::Scanline:
+            break;
+
+        case ObservationHeuristic::FrontierGrowth:
+            if (!m_entropyQueue.empty())
+            {
+                return { MinimalEntropyQueryResult::Success, coordsFromFlatIndex(m_entropyQueue.top().index) };
+            }
+
+            // start a new region
+            if (hasUntouchedCells)
+            {
+                return { MinimalEntropyQueryResult::Success, coordsFromFlatIndex(firstUntouchedCell()) };
+            }
+            break;
+
+        case ObservationHeuristic::MinimumRemainingValues:
+        case ObservationHeuristic::Entropy:
+            // untouched cells are not in the queue, they all have the initial entropy
+            if (!m_entropyQueue.empty() && (!hasUntouchedCells || m_entropyQueue.top().entropy <= m_initEntropy))
+            {
+                return { MinimalEntropyQueryResult::Success, coordsFromFlatIndex(m_entropyQueue.top().index) };
+            }
+
+            if (hasUntouchedCells)
+            {
+                return { MinimalEntropyQueryResult::Success, coordsFromFlatIndex(firstUntouchedCell()) };
+            }
+
+            // all settled
+            return { MinimalEntropyQueryResult::Finished, {} };
+        }
+
+        // touched undecided cells outside of the frontier can only be found by scanning
+        const int cellIdx = nextScanlineCell();
+        if (cellIdx < m_size.total())
+        {
+            return { MinimalEntropyQueryResult::Success, coordsFromFlatIndex(cellIdx) };
+        }
+
+        // all settled
+        return { MinimalEntropyQueryResult::Finished, {} };
+    }
+
+    // propagates every removal made since the last propagation, see ban()
+    void propagate()
+    {
+        switch (m_propagationEngine)
+        {
+        case PropagationEngine::SupportCounting:
+            propagate<PropagationEngine::SupportCounting>();
+            break;
+        case PropagationEngine::GroupedSupportCounting:
+            propagate<PropagationEngine::GroupedSupportCounting>();
+            break;
+        case PropagationEngine::ParallelSupportCounting:
+            propagate<PropagationEngine::ParallelSupportCounting>();
+            break;
+        case PropagationEngine::Bitset:
+            propagate<PropagationEngine::Bitset>();
+            break;
+        }
+        doPendingMemoUpdates();
+    }
+    
+    void doPendingMemoUpdates()
+    {
+        // growing the frontier appends to m_pendingMemoUpdates
+        for (std::size_t k = 0; k < m_pendingMemoUpdates.size(); ++k)
+        {
+            const int i = m_pendingMemoUpdates[k];
+
+            if (!m_memoNeedsUpdate[i])
+            {
+                continue;
+            }
+
+            m_memoNeedsUpdate[i] = 0;
+
+            const int numAvailableElements = m_numAvailableElements[i];
+            if (numAvailableElements == 0)
+            {
+                m_hasContradiction = true;
+            }
+
+            if (numAvailableElements > 1)
+            {
+                if (!usesEntropyQueue())
+                {
+                    continue;
+                }
+
+                m_entropies[i] = queueKey(i);
+            }
+            else if (m_observationHeuristic == ObservationHeuristic::FrontierGrowth)
+            {
+                growFrontier(i);
+            }
+
+            requeue(i);
         }
 
-        std::fill(std::begin(m_memo), std::end(m_memo), m_initEntry);
-
-        LOG_DEBUG(g_logger, "Created wave");
-        LOG_DEBUG(g_logger, "baseEntropy = ", baseEntropy);
-        LOG_DEBUG(g_logger, "numAvailableElements = ", freq.size());
-        LOG_DEBUG(g_logger, "entropy = ", -baseEntropy);
-        LOG_DEBUG(g_logger, "noiseMax = ", m_noiseMax);
-        LOG_DEBUG(g_logger, "size = (", m_size.width, ", ", m_size.height, ")");
+        m_pendingMemoUpdates.clear();
+    }
 
-        for (int i = 0; i < m_memo.size().total(); ++i)
+private:
+    template <PropagationEngine EngineV>
+    void propagate()
+    {
+        switch (m_wrapping)
         {
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-            m_memo.data()[i].iter = m_entropyQueue.push(EntropyQueueEntry{ m_memo.data()[i].entropy, i });
-#else
-            m_entropyQueue.push(EntropyQueueEntry{ m_memo.data()[i].entropy, i });
-#endif
+        case WrappingMode::None:
+            propagateImpl<EngineV, WrappingMode::None>();
+            break;
+        case WrappingMode::Horizontal:
+            propagateImpl<EngineV, WrappingMode::Horizontal>();
+            break;
+        case WrappingMode::Vertical:
+            propagateImpl<EngineV, WrappingMode::Vertical>();
+            break;
+        case WrappingMode::All:
+            propagateImpl<EngineV, WrappingMode::All>();
+            break;
         }
     }
 
-    Wave(const Wave&) = default;
-    Wave(Wave&&) = default;
-    Wave& operator=(const Wave&) = default;
-    Wave& operator=(Wave&&) = default;
-    ~Wave() = default;
-
-    void reset()
+    void markCellDirty(Coords2i pos)
     {
-        m_hasContradiction = false;
-        std::fill(std::begin(m_memo), std::end(m_memo), m_initEntry);
-        m_numCompatibile = initNumCompatibile();
-        m_canBePlaced.fill(true);
-        auto dNoise = randomNoiseGenerator(m_noiseMax);
-        for (auto& e : m_memo)
+        bool& isDirty = m_isCellDirty[pos];
+        if (!isDirty)
         {
-            e.entropy += dNoise();
+            isDirty = true;
+            m_dirtyCells.emplace_back(pos);
         }
+    }
 
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-        m_entropyQueue = EntropyQueueType(m_size.total());
-#else
-        m_entropyQueue = {};
-#endif
-        for (int i = 0; i < m_memo.size().total(); ++i)
+    void makeUnplacable(Coords2i pos, int elementId)
+    {
+        if (m_isRemoved[{ pos, elementId }])
         {
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-            m_memo.data()[i].iter = m_entropyQueue.push(EntropyQueueEntry{ m_memo.data()[i].entropy, i });
-#else
-            m_entropyQueue.push(EntropyQueueEntry{ m_memo.data()[i].entropy, i });
-#endif
+            return;
         }
-    }
 
-    // should only be called after whole wave is defined
-    // if everything went ok then it should always return a value
-    [[nodiscard]] int probe(Coords2i pos) const
-    {
-        const int numElements = static_cast<int>(m_plogp.size());
+        m_isRemoved.set({ pos, elementId });
 
-        for (int i = 0; i < numElements; ++i)
+        switch (m_propagationEngine)
         {
-            if (m_canBePlaced[{pos, i}])
-            {
-                return i;
-            }
+        case PropagationEngine::SupportCounting:
+            m_propagationQueue.emplace_back(pos, elementId);
+            break;
+        case PropagationEngine::GroupedSupportCounting:
+        case PropagationEngine::ParallelSupportCounting:
+            m_pendingRemovals.set({ pos, elementId });
+            markCellDirty(pos);
+            break;
+        case PropagationEngine::Bitset:
+            markCellDirty(pos);
+            break;
         }
 
-        // if we got here then it means that the wave is garbage
-        // so why not return garbage
-        return 0;
+        updateMemoAfterRemoval(pos, elementId);
     }
 
-    [[nodiscard]] Array2<int> probeSub(Coords2i start, Size2i size) const
+    // doesn't touch m_isRemoved
+    void updateMemoAfterRemoval(Coords2i pos, int elementId)
     {
-        Array2<int> ids(size);
-
-        const Coords2i end = start + Coords2i{ size.width, size.height }; 
-
-        for (int x = start.x; x < end.x; ++x)
+        const int memoIdx = flatIndex(pos);
+        touchCell(memoIdx);
+        saveMemoForUndo(memoIdx);
+        recordRemoval(memoIdx, elementId);
+        if (usesEntropySums())
         {
-            for (int y = start.y; y < end.y; ++y)
-            {
-                ids[x - start.x][y - start.y] = probe({ x, y });
-            }
+            auto& sums = m_entropySums[memoIdx];
+            sums.plogpSum -= m_fixedPlogp[elementId];
+            sums.pSum -= m_fixedP[elementId];
         }
-
-        return ids;
+        m_numAvailableElements[memoIdx] -= 1;
+        scheduleMemoUpdate(memoIdx);
     }
 
-    [[nodiscard]] Array2<int> probeAll() const
+    void makeUnplacableAllExcept(Coords2i pos, int preservedElementId)
     {
-        return probeSub({ 0, 0 }, size());
-    }
+        const bool wasPlacable = canBePlaced(pos, preservedElementId);
 
-    [[nodiscard]] ObservationResult observeOnce(std::vector<float>& ps) noexcept
-    {
-        const auto [status, pos] = posWithMinimalEntropy();
+        const int memoIdx = flatIndex(pos);
+        touchCell(memoIdx);
+        saveMemoForUndo(memoIdx);
 
-        if (status == Wave::MinimalEntropyQueryResult::Contradiction)
+        auto* removed = m_isRemoved[pos];
+        const int numWords = m_isRemoved.numWordsPerCell();
+        const int preservedWordId = preservedElementId / DomainType::bitsPerWord;
+        for (int i = 0; i < numWords; ++i)
         {
-            return ObservationResult::Contradiction;
+            const auto preservedMask = i == preservedWordId ? DomainType::bitMask(preservedElementId) : 0;
+            const int base = i * DomainType::bitsPerWord;
+            const auto newlyRemoved = availableWord(removed, i) & ~preservedMask;
+            util::forEachSetBit(newlyRemoved, [&](int bit) { recordRemoval(memoIdx, base + bit); });
+            if (m_propagationEngine == PropagationEngine::SupportCounting)
+            {
+                util::forEachSetBit(newlyRemoved, [&](int bit) {
+                    m_propagationQueue.emplace_back(pos, base + bit);
+                });
+            }
+            else if (usesPendingRemovals())
+            {
+                m_pendingRemovals[pos][i] |= newlyRemoved;
+            }
+            removed[i] = m_elementMask[i] & ~preservedMask;
         }
 
-        if (status == Wave::MinimalEntropyQueryResult::Finished)
+        if (m_propagationEngine != PropagationEngine::SupportCounting)
         {
-            return ObservationResult::Finished;
+            markCellDirty(pos);
         }
 
-        LOG_DEBUG(g_logger, "Observed (", pos.x, ", ", pos.y, ")");
-
-        const int numPatterns = numElements();
-
-        // choose an element according to the pattern distribution
-        float pssum = 0.0f;
+        m_entropySums[memoIdx] = EntropySums{ m_fixedPlogp[preservedElementId], m_fixedP[preservedElementId] };
+        m_numAvailableElements[memoIdx] = wasPlacable;
+        if (!wasPlacable)
         {
-            for (int i = 0; i < numPatterns; ++i)
-            {
-                pssum += canBePlaced(pos, i) ? m_p[i] : 0.0f;
-                ps[i] = pssum;
-            }
+            m_hasContradiction = true;
         }
-
-        std::uniform_real_distribution<float> dPssum(0.0f, pssum);
-        const float r = std::min(dPssum(m_rng), pssum); // min just in case of unfortunate rounding
-        const auto iter = std::lower_bound(std::begin(ps), std::end(ps), r);
-        const int patternId = static_cast<int>(std::distance(std::begin(ps), iter));
-
-        setElement(pos, patternId);
-
-        return ObservationResult::Unfinished;
+        // we don't need to change entropy since the values doesn't matter anymore anyway
+        // but the cell has to leave the entropy queue and may grow the frontier
+        scheduleMemoUpdate(memoIdx);
     }
 
-    [[nodiscard]] Size2i size() const
+    void pushDecision(Coords2i pos, int elementId)
     {
-        return m_size;
+        m_decisions.push_back(Decision{
+            pos,
+            elementId,
+            static_cast<int>(m_removalTrail.size()),
+            static_cast<int>(m_memoTrail.size()),
+            static_cast<int>(m_touchedCells.size()),
+            m_scanlineCursor
+        });
+        m_trailStamp += 1;
     }
 
-    [[nodiscard]] int numElements() const
+    // undoes decisions until there is no contradiction, each undone choice is banned
+    // which may in turn cause a contradiction that requires going back further
+    void backtrackWhileContradiction()
     {
-        return static_cast<int>(m_plogp.size());
-    }
+        while (m_hasContradiction && !m_decisions.empty() && m_numBacktracks < m_maxBacktracks)
+        {
+            m_numBacktracks += 1;
 
-    [[nodiscard]] bool canBePlaced(Coords2i pos, int elementId) const
-    {
-        return m_canBePlaced[{pos, elementId}];
-    }
+            const Decision decision = m_decisions.back();
+            undoLastDecision();
 
-    void setElement(Coords2i pos, int elementId)
-    {
-        // define the cell with the chosen pattern by disabling others
-        makeUnplacableAllExcept(pos, elementId);
+            LOG_DEBUG(g_logger, "Backtracked (", decision.pos.x, ", ", decision.pos.y, ")");
 
-        propagate();
+            // the ban belongs to the previous decision
+            makeUnplacable(decision.pos, decision.elementId);
+            propagate();
+        }
     }
 
-    [[nodiscard]] std::pair<MinimalEntropyQueryResult, Coords2i> posWithMinimalEntropy()
+    // restores the state from just before the last decision was propagated
+    // only valid when the propagation is finished
+    void undoLastDecision()
     {
-        if (m_hasContradiction)
-        {
-            // there's cannot be an unassignable element
-            return { MinimalEntropyQueryResult::Contradiction, {} };
-        }
-
-#if !defined(USE_UPDATABLE_PRIORITY_QUEUE)
-        while (!m_entropyQueue.empty() && m_memo.data()[m_entropyQueue.top().index].numAvailableElements <= 1)
-        {
-            m_entropyQueue.pop();
-        }
-#endif
-
-        // all settled
-        if (m_entropyQueue.empty())
-        {
-            return { MinimalEntropyQueryResult::Finished, {} };
-        }
+        const Decision decision = m_decisions.back();
+        m_decisions.pop_back();
 
-        return { MinimalEntropyQueryResult::Success, m_memo.coordsFromFlatIndex(m_entropyQueue.top().index) };
-    }
+        // every stamp made since the decision becomes stale
+        m_trailStamp += 1;
 
-    void propagate()
-    {
         switch (m_wrapping)
         {
         case WrappingMode::None:
-            propagateImpl<WrappingMode::None>();
+            undoRemovals<WrappingMode::None>(decision.removalTrailSize);
             break;
         case WrappingMode::Horizontal:
-            propagateImpl<WrappingMode::Horizontal>();
+            undoRemovals<WrappingMode::Horizontal>(decision.removalTrailSize);
             break;
         case WrappingMode::Vertical:
-            propagateImpl<WrappingMode::Vertical>();
+            undoRemovals<WrappingMode::Vertical>(decision.removalTrailSize);
             break;
         case WrappingMode::All:
-            propagateImpl<WrappingMode::All>();
+            undoRemovals<WrappingMode::All>(decision.removalTrailSize);
             break;
         }
-        doPendingMemoUpdates();
-    }
-    
-    void doPendingMemoUpdates()
-    {
-        auto* memos = m_memo.data();
-        for (int i : m_pendingMemoUpdates)
+
+        while (static_cast<int>(m_memoTrail.size()) > decision.memoTrailSize)
         {
-            auto& memo = memos[i];
+            const MemoSnapshot snapshot = m_memoTrail.back();
+            m_memoTrail.pop_back();
 
-            if (!memo.needsUpdate)
-            {
-                continue;
-            }
+            const int i = snapshot.index;
+            m_entropySums[i] = snapshot.sums;
+            m_numAvailableElements[i] = snapshot.numAvailableElements;
+            m_entropies[i] = snapshot.entropy;
 
-            memo.needsUpdate = false;
+            requeue(i);
+        }
 
-            if (memo.numAvailableElements == 0)
-            {
-                m_hasContradiction = true;
-            }
+        // cells first touched after the decision go back to the shared initial state
+        while (static_cast<int>(m_touchedCells.size()) > decision.numTouchedCells)
+        {
+            const int i = m_touchedCells.back();
+            m_touchedCells.pop_back();
 
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-            if (memo.iter != invalidNodeHandle)
+            if (m_entropyQueue.contains(i))
             {
-                if (memo.numAvailableElements <= 1)
-                {
-                    m_entropyQueue.erase(memo.iter);
-                    memo.iter = invalidNodeHandle;
-                }
-                else
-                {
-                    memo.entropy = util::approximateLog(memo.pSum) - memo.plogpSum / memo.pSum + randomNoiseGenerator(m_noiseMax)();
-                    m_entropyQueue.update(memo.iter, [entropy = memo.entropy](EntropyQueueEntry& e) {e.entropy = entropy; });
-                }
+                m_entropyQueue.erase(i);
             }
-#else
-            if (memo.numAvailableElements > 1)
+            m_memoNeedsUpdate[i] = 0;
+            m_isCellTouched[i / DomainType::bitsPerWord] &= ~DomainType::bitMask(i);
+            if (!m_isFrontier.empty())
             {
-                memo.entropy = util::approximateLog(memo.pSum) - memo.plogpSum / memo.pSum + randomNoiseGenerator(m_noiseMax)();
-                m_entropyQueue.push(EntropyQueueEntry{ memo.entropy, i });
+                m_isFrontier[i / DomainType::bitsPerWord] &= ~DomainType::bitMask(i);
             }
-#endif
         }
 
-        m_pendingMemoUpdates.clear();
+        // frontier flags of cells that stay touched are kept
+        // so the frontier can only be larger than it would be without the decision
+        m_scanlineCursor = decision.scanlineCursor;
+        m_hasContradiction = false;
     }
 
-private:
-    void makeUnplacable(Coords2i pos, int elementId)
+    // puts the removed elements back, along with the supports they took from the neighbours
+    template <WrappingMode WrapV>
+    void undoRemovals(int trailSize)
     {
-        const int idx = m_canBePlaced.getFlatIndex({ pos, elementId });
-        auto& canBePlaced = m_canBePlaced.data()[idx];
-        if (!canBePlaced)
+        auto popRemovals = [this, trailSize](auto&& onRemovalUndone) {
+            while (static_cast<int>(m_removalTrail.size()) > trailSize)
+            {
+                const auto [cellIdx, elementId] = m_removalTrail.back();
+                m_removalTrail.pop_back();
+
+                const Coords2i pos = coordsFromFlatIndex(cellIdx);
+                m_isRemoved.reset({ pos, elementId });
+                onRemovalUndone(pos, elementId);
+            }
+        };
+
+        if (!usesSupportCounters())
         {
+            popRemovals([](Coords2i, int) {});
             return;
         }
 
-        canBePlaced = false;
-
-        m_numCompatibile.data()[idx] = {};
-        m_propagationQueue.emplace_back(pos, elementId);
-
-        const int memoIdx = m_memo.getFlatIndex(pos);
-        auto& memo = m_memo.data()[memoIdx];
-        memo.plogpSum -= m_plogp[elementId];
-        memo.pSum -= m_p[elementId];
-        memo.numAvailableElements -= 1;
-        memo.needsUpdate = true;
-
-        m_pendingMemoUpdates.emplace_back(memoIdx);
+        std::visit([&](auto& numCompatibile) {
+            popRemovals([&](Coords2i pos, int elementId) {
+                forNeighbour<WrapV, Direction::North>(pos.x, pos.y, [&](Coords2i neighbour) { unpropagateTo(numCompatibile, Direction::North, neighbour, elementId); });
+                forNeighbour<WrapV, Direction::East>(pos.x, pos.y, [&](Coords2i neighbour) { unpropagateTo(numCompatibile, Direction::East, neighbour, elementId); });
+                forNeighbour<WrapV, Direction::South>(pos.x, pos.y, [&](Coords2i neighbour) { unpropagateTo(numCompatibile, Direction::South, neighbour, elementId); });
+                forNeighbour<WrapV, Direction::West>(pos.x, pos.y, [&](Coords2i neighbour) { unpropagateTo(numCompatibile, Direction::West, neighbour, elementId); });
+            });
+        }, m_numCompatibile);
     }
 
-    void makeUnplacableAllExcept(Coords2i pos, int preservedElementId)
+    // inverse of propagateTo, every removal was propagated exactly once
+    template <typename CounterT>
+    void unpropagateTo(SupportCounters<CounterT>& counters, Direction dir, Coords2i pos, int elementId)
     {
-        const int end = numElements();
+        auto* numRemoved = counters.numRemoved[pos] + toId(dir) * numElements();
+        for (const int compatibileElementId : m_compatibile(elementId, dir))
+        {
+            numRemoved[compatibileElementId] -= 1;
+        }
+    }
 
-        for (int elementId = 0; elementId < end; ++elementId)
+    template <PropagationEngine EngineV, WrappingMode WrapV>
+    void propagateImpl()
+    {
+        if constexpr (EngineV == PropagationEngine::SupportCounting)
         {
-            if (elementId == preservedElementId)
-            {
-                continue;
-            }
+            // resolve the counter type once for the whole propagation
+            std::visit([this](auto& numCompatibile) {
+                while (!m_propagationQueue.empty())
+                {
+                    /*const*/ auto [x, y, elementId] = m_propagationQueue.back();
+                    m_propagationQueue.pop_back();
 
-            const int idx = m_canBePlaced.getFlatIndex({ pos, elementId });
-            auto& canBePlaced = m_canBePlaced.data()[idx];
-            if (canBePlaced)
-            {
-                m_numCompatibile.data()[idx] = {};
-                m_propagationQueue.emplace_back(pos, elementId);
-                canBePlaced = false;
-            }
+                    forNeighbour<WrapV, Direction::North>(x, y, [&](Coords2i pos) { propagateTo(numCompatibile, Direction::North, pos, elementId); });
+                    forNeighbour<WrapV, Direction::East>(x, y, [&](Coords2i pos) { propagateTo(numCompatibile, Direction::East, pos, elementId); });
+                    forNeighbour<WrapV, Direction::South>(x, y, [&](Coords2i pos) { propagateTo(numCompatibile, Direction::South, pos, elementId); });
+                    forNeighbour<WrapV, Direction::West>(x, y, [&](Coords2i pos) { propagateTo(numCompatibile, Direction::West, pos, elementId); });
+                }
+            }, m_numCompatibile);
         }
+        else if constexpr (EngineV == PropagationEngine::GroupedSupportCounting)
+        {
+            std::visit([this](auto& numCompatibile) {
+                const int numWords = m_isRemoved.numWordsPerCell();
+                auto* removed = m_cellScratch.data();
 
-        auto& memo = m_memo[pos];
-        memo.plogpSum = m_plogp[preservedElementId];
-        memo.pSum = m_p[preservedElementId];
-        memo.numAvailableElements = m_canBePlaced[{pos, preservedElementId}];
-        if (memo.numAvailableElements == 0)
+                while (!m_dirtyCells.empty())
+                {
+                    const Coords2i pos = m_dirtyCells.back();
+                    m_dirtyCells.pop_back();
+                    m_isCellDirty[pos] = false;
+
+                    // take the whole batch, removals caused by it form the next one
+                    auto* pending = m_pendingRemovals[pos];
+                    std::copy(pending, pending + numWords, removed);
+                    std::fill(pending, pending + numWords, DomainWordType(0));
+
+                    forNeighbour<WrapV, Direction::North>(pos.x, pos.y, [&](Coords2i neighbour) { propagateAllTo(numCompatibile, Direction::North, neighbour, removed); });
+                    forNeighbour<WrapV, Direction::East>(pos.x, pos.y, [&](Coords2i neighbour) { propagateAllTo(numCompatibile, Direction::East, neighbour, removed); });
+                    forNeighbour<WrapV, Direction::South>(pos.x, pos.y, [&](Coords2i neighbour) { propagateAllTo(numCompatibile, Direction::South, neighbour, removed); });
+                    forNeighbour<WrapV, Direction::West>(pos.x, pos.y, [&](Coords2i neighbour) { propagateAllTo(numCompatibile, Direction::West, neighbour, removed); });
+                }
+            }, m_numCompatibile);
+        }
+        else if constexpr (EngineV == PropagationEngine::ParallelSupportCounting)
         {
-            m_hasContradiction = true;
+            std::visit([this](auto& numCompatibile) {
+                while (!m_dirtyCells.empty())
+                {
+                    propagateLevel<WrapV>(numCompatibile);
+                }
+            }, m_numCompatibile);
         }
-#if defined(USE_UPDATABLE_PRIORITY_QUEUE)
-        // we don't need to change entropy since the values doesn't matter anymore anyway
-        if (memo.iter != invalidNodeHandle)
+        else
         {
-            m_entropyQueue.erase(memo.iter);
-            memo.iter = invalidNodeHandle;
+            while (!m_dirtyCells.empty())
+            {
+                const Coords2i pos = m_dirtyCells.back();
+                m_dirtyCells.pop_back();
+                m_isCellDirty[pos] = false;
+
+                forNeighbour<WrapV, Direction::North>(pos.x, pos.y, [&](Coords2i neighbour) { restrictByBitset(Direction::North, pos, neighbour); });
+                forNeighbour<WrapV, Direction::East>(pos.x, pos.y, [&](Coords2i neighbour) { restrictByBitset(Direction::East, pos, neighbour); });
+                forNeighbour<WrapV, Direction::South>(pos.x, pos.y, [&](Coords2i neighbour) { restrictByBitset(Direction::South, pos, neighbour); });
+                forNeighbour<WrapV, Direction::West>(pos.x, pos.y, [&](Coords2i neighbour) { restrictByBitset(Direction::West, pos, neighbour); });
+            }
         }
-#endif
     }
 
-    template <WrappingMode WrapV>
-    void propagateImpl()
+    // calls func with every neighbour of pos, not for hot paths
+    template <typename FuncT>
+    void forEachNeighbour(Coords2i pos, FuncT&& func)
     {
-        while (!m_propagationQueue.empty())
-        {
-            /*const*/ auto [x, y, elementId] = m_propagationQueue.back();
-            m_propagationQueue.pop_back();
+        auto forEach = [this, pos, &func](auto wrapTag) {
+            constexpr WrappingMode wrapV = decltype(wrapTag)::value;
+            forNeighbour<wrapV, Direction::North>(pos.x, pos.y, func);
+            forNeighbour<wrapV, Direction::East>(pos.x, pos.y, func);
+            forNeighbour<wrapV, Direction::South>(pos.x, pos.y, func);
+            forNeighbour<wrapV, Direction::West>(pos.x, pos.y, func);
+        };
 
-            applyOffsetAndPropagate<WrapV, Direction::North>(x, y, elementId);
-            applyOffsetAndPropagate<WrapV, Direction::East>(x, y, elementId);
-            applyOffsetAndPropagate<WrapV, Direction::South>(x, y, elementId);
-            applyOffsetAndPropagate<WrapV, Direction::West>(x, y, elementId);
+        switch (m_wrapping)
+        {
+        case WrappingMode::None:
+            forEach(std::integral_constant<WrappingMode, WrappingMode::None>{});
+            break;
+        case WrappingMode::Horizontal:
+            forEach(std::integral_constant<WrappingMode, WrappingMode::Horizontal>{});
+            break;
+        case WrappingMode::Vertical:
+            forEach(std::integral_constant<WrappingMode, WrappingMode::Vertical>{});
+            break;
+        case WrappingMode::All:
+            forEach(std::integral_constant<WrappingMode, WrappingMode::All>{});
+            break;
         }
     }
 
-    // wraps to size of the wave
-    template <WrappingMode WrapV, Direction DirV>
-    void applyOffsetAndPropagate(int x, int y, int elementId)
+    // calls func with the neighbour of (x, y) in the DirV direction
+    // wraps to size of the wave, does nothing if there is no neighbour
+    // or if it's masked out
+    template <WrappingMode WrapV, Direction DirV, typename FuncT>
+    void forNeighbour(int x, int y, FuncT&& func)
     {
         constexpr int dx = offset(DirV).x;
         constexpr int dy = offset(DirV).y;
@@ -615,27 +1738,253 @@ private:
             }
         }
 
-        propagateTo(DirV, { x2, y2 }, elementId);
+        if (!m_isCellMaskedOut.empty() && isCellMaskedOut(flatIndex({ x2, y2 })))
+        {
+            return;
+        }
+
+        func(Coords2i{ x2, y2 });
+    }
+
+    template <typename CounterT>
+    void propagateTo(SupportCounters<CounterT>& counters, Direction dir, Coords2i pos, int elementId)
+    {
+        const auto compatibileElements = m_compatibile(elementId, dir);
+        const int offset = toId(dir) * numElements();
+
+        touchCell(flatIndex(pos));
+
+        // count the removed support
+        // and handle the case when we end up with none compatibile left
+        simd::incrementAndCollectLimitReached(
+            counters.numRemoved[pos] + offset,
+            counters.numSupports.data() + offset,
+            compatibileElements.begin(),
+            compatibileElements.size(),
+            [this, pos](int compatibileElementId) { makeUnplacable(pos, compatibileElementId); }
+        );
+    }
+
+    // propagates the removals pending in all m_dirtyCells
+    // replaces m_dirtyCells with the cells that lost elements because of that
+    template <WrappingMode WrapV, typename CounterT>
+    void propagateLevel(SupportCounters<CounterT>& counters)
+    {
+        // sequential, collect every cell next to the current level
+        // touching them now means that workers never modify shared state
+        for (Coords2i pos : m_dirtyCells)
+        {
+            m_isCellDirty[pos] = false;
+        }
+
+        auto addTarget = [this](Coords2i target) {
+            bool& isTarget = m_isCellDirty[target];
+            if (!isTarget)
+            {
+                isTarget = true;
+                m_targetCells.emplace_back(target);
+                touchCell(flatIndex(target));
+            }
+        };
+        for (Coords2i pos : m_dirtyCells)
+        {
+            forNeighbour<WrapV, Direction::North>(pos.x, pos.y, addTarget);
+            forNeighbour<WrapV, Direction::East>(pos.x, pos.y, addTarget);
+            forNeighbour<WrapV, Direction::South>(pos.x, pos.y, addTarget);
+            forNeighbour<WrapV, Direction::West>(pos.x, pos.y, addTarget);
+        }
+
+        // parallel, every target pulls the removals from its neighbours
+        // and only writes its own counters, domain and next pending removals
+        constexpr int grainSize = 64;
+        ThreadPool::instance().parallelFor(static_cast<int>(m_targetCells.size()), grainSize, [this, &counters](int begin, int end) {
+            for (int i = begin; i < end; ++i)
+            {
+                const Coords2i target = m_targetCells[i];
+
+                // the source is the neighbour for which target is the neighbour in `dir`
+                forNeighbour<WrapV, Direction::South>(target.x, target.y, [&](Coords2i source) { pullRemovals(counters, Direction::North, target, source); });
+                forNeighbour<WrapV, Direction::West>(target.x, target.y, [&](Coords2i source) { pullRemovals(counters, Direction::East, target, source); });
+                forNeighbour<WrapV, Direction::North>(target.x, target.y, [&](Coords2i source) { pullRemovals(counters, Direction::South, target, source); });
+                forNeighbour<WrapV, Direction::East>(target.x, target.y, [&](Coords2i source) { pullRemovals(counters, Direction::West, target, source); });
+            }
+        });
+
+        // sequential, in a fixed order so that memo updates don't depend on scheduling
+        const int numWords = m_isRemoved.numWordsPerCell();
+        for (Coords2i pos : m_dirtyCells)
+        {
+            auto* pending = m_pendingRemovals[pos];
+            std::fill(pending, pending + numWords, DomainWordType(0));
+        }
+        m_dirtyCells.clear();
+
+        for (Coords2i target : m_targetCells)
+        {
+            m_isCellDirty[target] = false;
+
+            auto* nextPending = m_nextPendingRemovals[target];
+            auto* pending = m_pendingRemovals[target];
+            bool anyRemoved = false;
+            for (int i = 0; i < numWords; ++i)
+            {
+                if (nextPending[i])
+                {
+                    anyRemoved = true;
+                    pending[i] = nextPending[i];
+                    nextPending[i] = 0;
+
+                    const int base = i * DomainType::bitsPerWord;
+                    util::forEachSetBit(pending[i], [&](int bit) { updateMemoAfterRemoval(target, base + bit); });
+                }
+            }
+
+            if (anyRemoved)
+            {
+                markCellDirty(target);
+            }
+        }
+        m_targetCells.clear();
+    }
+
+    // applies removals pending at `source` to the counters of its neighbour `target` in the `dir` direction
+    // may be called concurrently for different targets
+    template <typename CounterT>
+    void pullRemovals(SupportCounters<CounterT>& counters, Direction dir, Coords2i target, Coords2i source)
+    {
+        const int numWords = m_isRemoved.numWordsPerCell();
+        const int offset = toId(dir) * numElements();
+        const auto* pending = m_pendingRemovals[source];
+        auto* numRemoved = counters.numRemoved[target] + offset;
+        const auto* numSupports = counters.numSupports.data() + offset;
+        auto* removed = m_isRemoved[target];
+        auto* nextPending = m_nextPendingRemovals[target];
+
+        for (int i = 0; i < numWords; ++i)
+        {
+            const int base = i * DomainType::bitsPerWord;
+            util::forEachSetBit(pending[i], [&](int bit) {
+                const auto compatibileElements = m_compatibile(base + bit, dir);
+                simd::incrementAndCollectLimitReached(
+                    numRemoved,
+                    numSupports,
+                    compatibileElements.begin(),
+                    compatibileElements.size(),
+                    [removed, nextPending](int compatibileElementId) {
+                        const auto mask = DomainType::bitMask(compatibileElementId);
+                        auto& word = removed[compatibileElementId / DomainType::bitsPerWord];
+                        if (!(word & mask))
+                        {
+                            word |= mask;
+                            nextPending[compatibileElementId / DomainType::bitsPerWord] |= mask;
+                        }
+                    }
+                );
+            });
+        }
     }
 
-    void propagateTo(Direction dir, Coords2i pos, int elementId)
+    // propagateTo for every element in the `removed` set
+    template <typename CounterT>
+    void propagateAllTo(SupportCounters<CounterT>& counters, Direction dir, Coords2i pos, const DomainWordType* removed)
     {
-        const auto& compatibileElements = m_compatibile[elementId][dir];
-        auto* numCompatibile = m_numCompatibile[pos];
-        for (const int compatibileElementId : compatibileElements)
+        const int numWords = m_isRemoved.numWordsPerCell();
+        for (int i = 0; i < numWords; ++i)
         {
-            // decrease the number of compatibile elements
-            // and handle the case when we end up with none compatibile left
+            const int base = i * DomainType::bitsPerWord;
+            util::forEachSetBit(removed[i], [&](int bit) { propagateTo(counters, dir, pos, base + bit); });
+        }
+    }
+
+    // removes from the domain at `neighbour` all elements not supported
+    // in the `dir` direction by any element still placable at `pos`
+    void restrictByBitset(Direction dir, Coords2i pos, Coords2i neighbour)
+    {
+        const int numWords = m_isRemoved.numWordsPerCell();
+        const auto* removed = m_isRemoved[pos];
+
+        auto* supported = m_cellScratch.data();
+        std::fill(supported, supported + numWords, DomainWordType(0));
 
-            auto& count = numCompatibile[compatibileElementId][dir];
-            count -= 1;
+        for (int i = 0; i < numWords; ++i)
+        {
+            const int base = i * DomainType::bitsPerWord;
+            util::forEachSetBit(availableWord(removed, i), [&](int bit) {
+                const auto* mask = m_supportMasks.data() + ((base + bit) * cardinality<Direction>() + toId(dir)) * numWords;
+                for (int j = 0; j < numWords; ++j)
+                {
+                    supported[j] |= mask[j];
+                }
+            });
+        }
 
-            if (count == 0)
+        auto* neighbourRemoved = m_isRemoved[neighbour];
+        bool anyRemoved = false;
+        for (int i = 0; i < numWords; ++i)
+        {
+            const auto newlyRemoved = availableWord(neighbourRemoved, i) & ~supported[i];
+            if (newlyRemoved)
             {
-                makeUnplacable(pos, compatibileElementId);
+                anyRemoved = true;
+                neighbourRemoved[i] |= newlyRemoved;
+
+                const int base = i * DomainType::bitsPerWord;
+                util::forEachSetBit(newlyRemoved, [&](int bit) { updateMemoAfterRemoval(neighbour, base + bit); });
             }
         }
-    };
+
+        if (anyRemoved)
+        {
+            markCellDirty(neighbour);
+        }
+    }
+};
+
+using Wave = BasicWave<>;
+
+template <typename WaveT>
+struct WaveTypeTag
+{
+    using Type = WaveT;
 };
 
-#undef USE_UPDATABLE_PRIORITY_QUEUE
+// calls func with WaveTypeTag<BasicWave<NumWordsV, EntropyQueueT>>
+// where EntropyQueueT is the queue implementing `backend`
+template <int NumWordsV, typename FuncT>
+decltype(auto) withWaveTypeFor(EntropyQueueBackend backend, FuncT&& func)
+{
+    switch (backend)
+    {
+    case EntropyQueueBackend::IndexedHeap:
+        return func(WaveTypeTag<BasicWave<NumWordsV, IndexedHeapEntropyQueue>>{});
+    case EntropyQueueBackend::Bucket:
+        return func(WaveTypeTag<BasicWave<NumWordsV, BucketEntropyQueue>>{});
+    case EntropyQueueBackend::Tree:
+    default:
+        return func(WaveTypeTag<BasicWave<NumWordsV, TreeEntropyQueue>>{});
+    }
+}
+
+// calls func with WaveTypeTag<WaveT> for the most specialized
+// wave type that can handle `numElements` elements
+// with the entropy queue given by `backend`
+template <typename FuncT>
+decltype(auto) withWaveTypeFor(int numElements, EntropyQueueBackend backend, FuncT&& func)
+{
+    if (numElements <= 64)
+    {
+        return withWaveTypeFor<1>(backend, std::forward<FuncT>(func));
+    }
+    else if (numElements <= 128)
+    {
+        return withWaveTypeFor<2>(backend, std::forward<FuncT>(func));
+    }
+    else if (numElements <= 256)
+    {
+        return withWaveTypeFor<4>(backend, std::forward<FuncT>(func));
+    }
+    else
+    {
+        return withWaveTypeFor<0>(backend, std::forward<FuncT>(func));
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+#include "NormalizedHistogram.h"
+#include "ObservationHeuristic.h"
+#include "PropagationEngine.h"
+#include "RandomNumberMode.h"
+#include "Size2.h"
+#include "WrappingMode.h"
+
+// keeps finished waves around so that their storage can be reused by the next generation
+// waves are keyed by (size, number of elements), which is all that determines their storage
+// not thread safe, meant to be used as a thread_local, see Model::next
+template <typename WaveT>
+struct WavePool
+{
+    using CompatibilityArrayType = typename WaveT::CompatibilityArrayType;
+
+    // upper bound on the number of differently shaped waves kept alive
+    static constexpr int maxSize = 8;
+
+    // returns a wave in the same state as WaveT(compatibility, seed, size, freq, wrapping, engine, heuristic, randomNumberMode)
+    // the reference is valid until the next call to acquire
+    [[nodiscard]] WaveT& acquire(const CompatibilityArrayType& compatibility, std::uint64_t seed, Size2i size, const NormalizedFrequencies& freq, WrappingMode wrapping, PropagationEngine engine, ObservationHeuristic heuristic, RandomNumberMode randomNumberMode)
+    {
+        const KeyType key{ size.width, size.height, freq.size() };
+
+        auto iter = m_waves.find(key);
+        if (iter != m_waves.end())
+        {
+            iter->second.rebind(compatibility, seed, freq, wrapping, engine, heuristic, randomNumberMode);
+            return iter->second;
+        }
+
+        if (static_cast<int>(m_waves.size()) >= maxSize)
+        {
+            m_waves.erase(m_waves.begin());
+        }
+
+        return m_waves.try_emplace(key, compatibility, seed, size, freq, wrapping, engine, heuristic, randomNumberMode).first->second;
+    }
+
+    void clear()
+    {
+        m_waves.clear();
+    }
+
+private:
+    // width, height, number of elements
+    using KeyType = std::tuple<int, int, int>;
+
+    std::map<KeyType, WaveT> m_waves;
+};
@@ -386,6 +386,99 @@ void testQueue()
     assert(q.size() == 9);
 }
 
+// with RandomNumberMode::CounterBased the support counting engines have to give the same outputs
+// for every combination of the observation heuristic and the entropy queue backend
+// PropagationEngine::Bitset is not compared, see RandomNumberMode::CounterBased
+bool checkEnginesAgree()
+{
+    using Tiled = TiledModel<ColorRGBi>;
+    using TiledOpt = typename TiledModel<ColorRGBi>::OptionsType;
+    using Overlapping = OverlappingModel<ColorRGBi>;
+    using OverlappingOpt = typename OverlappingModel<ColorRGBi>::OptionsType;
+
+    static constexpr int numSeeds = 4;
+
+    const std::array<PropagationEngine, 3> engines = {
+        PropagationEngine::SupportCounting,
+        PropagationEngine::GroupedSupportCounting,
+        PropagationEngine::ParallelSupportCounting
+    };
+
+    // outputs of all seeds, an empty array for a contradiction
+    auto generate = [](auto&& model) {
+        std::vector<Array2<ColorRGBi>> outputs;
+        for (int seed = 0; seed < numSeeds; ++seed)
+        {
+            outputs.emplace_back(model.next(seed).value_or(Array2<ColorRGBi>()));
+        }
+        return outputs;
+    };
+
+    auto areEqual = [](const std::vector<Array2<ColorRGBi>>& lhs, const std::vector<Array2<ColorRGBi>>& rhs) {
+        for (int i = 0; i < numSeeds; ++i)
+        {
+            if (lhs[i].size() != rhs[i].size() || !std::equal(std::begin(lhs[i]), std::end(lhs[i]), std::begin(rhs[i])))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    const Array2<ColorRGBi> flowers = loadImage("sample_in/flowers.png");
+    const TileSet<ColorRGBi> knot = makeKnotTileSet();
+
+    bool allAgree = true;
+    for (ObservationHeuristic heuristic : { ObservationHeuristic::Scanline, ObservationHeuristic::MinimumRemainingValues, ObservationHeuristic::Entropy, ObservationHeuristic::FrontierGrowth })
+    {
+        for (EntropyQueueBackend backend : { EntropyQueueBackend::Tree, EntropyQueueBackend::IndexedHeap, EntropyQueueBackend::Bucket })
+        {
+            std::vector<Array2<ColorRGBi>> expectedKnot;
+            std::vector<Array2<ColorRGBi>> expectedFlowers;
+            for (PropagationEngine engine : engines)
+            {
+                const auto knotOutputs = generate(Tiled(
+                    knot,
+                    TiledOpt()
+                        .withOutputSize({ 48, 48 })
+                        .withOutputWrapping(WrappingMode::All)
+                        .withPropagationEngine(engine)
+                        .withObservationHeuristic(heuristic)
+                        .withEntropyQueueBackend(backend)
+                        .withRandomNumberMode(RandomNumberMode::CounterBased)
+                ));
+
+                const auto flowersOutputs = generate(Overlapping(
+                    flowers,
+                    OverlappingOpt()
+                        .withOutputSize({ 48, 48 })
+                        .withPatternSize(3)
+                        .withPropagationEngine(engine)
+                        .withObservationHeuristic(heuristic)
+                        .withEntropyQueueBackend(backend)
+                        .withRandomNumberMode(RandomNumberMode::CounterBased)
+                        .withMaxBacktracks(50)
+                ));
+
+                if (engine == engines.front())
+                {
+                    expectedKnot = knotOutputs;
+                    expectedFlowers = flowersOutputs;
+                    continue;
+                }
+
+                if (!areEqual(expectedKnot, knotOutputs) || !areEqual(expectedFlowers, flowersOutputs))
+                {
+                    LOG_ERROR(g_logger, "Engine ", static_cast<int>(engine), " differs with heuristic ", static_cast<int>(heuristic), " and backend ", static_cast<int>(backend));
+                    allAgree = false;
+                }
+            }
+        }
+    }
+
+    return allAgree;
+}
+
 template <typename ModelT>
 std::chrono::nanoseconds generateAndSave(ModelT&& model, int count, std::string dir)
 {
@@ -722,11 +815,95 @@ std::chrono::nanoseconds generateAndSaveExamples()
     return duration;
 }
 
+// runs the same generations on a few models, `withOption` is applied to the options of each
+// the models have fixed seeds so each call does the same tries
+template <typename FuncT>
+void benchmarkModels(FuncT&& withOption)
+{
+    using Tiled = TiledModel<ColorRGBi>;
+    using TiledOpt = typename TiledModel<ColorRGBi>::OptionsType;
+    using Overlapping = OverlappingModel<ColorRGBi>;
+    using OverlappingOpt = typename OverlappingModel<ColorRGBi>::OptionsType;
+
+    static constexpr int numTries = 16;
+
+    auto run = [](auto&& model) {
+        int numSuccessful = 0;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < numTries; ++i)
+        {
+            numSuccessful += model.next().has_value();
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        LOG_INFO(g_logger, "    Successful: ", numSuccessful, "/", numTries, ", Gen time: ", elapsedSeconds(t0, t1) / numTries);
+    };
+
+    LOG_INFO(g_logger, "  flowers 128x128");
+    run(Overlapping(
+        loadImage("sample_in/flowers.png"),
+        withOption(OverlappingOpt()
+            .withOutputSize({ 128, 128 })
+            .withOutputWrapping(WrappingMode::All)
+            .withInputWrapping(WrappingMode::All)
+            .withPatternSize(3)
+            .withSymmetries(D4Symmetries::All))
+    ));
+
+    LOG_INFO(g_logger, "  knot 256x256");
+    run(Tiled(
+        makeKnotTileSet(),
+        withOption(TiledOpt()
+            .withOutputSize({ 256, 256 })
+            .withOutputWrapping(WrappingMode::All))
+    ));
+
+    LOG_INFO(g_logger, "  circuit 64x64");
+    run(Tiled(
+        makeCircuitTileSet(),
+        withOption(TiledOpt()
+            .withOutputSize({ 64, 64 })
+            .withOutputWrapping(WrappingMode::All))
+    ));
+}
+
+void benchmarkEntropyQueues()
+{
+    for (const auto& [backend, name] : std::map<EntropyQueueBackend, std::string>{
+        { EntropyQueueBackend::Tree, "tree" },
+        { EntropyQueueBackend::IndexedHeap, "indexed heap" },
+        { EntropyQueueBackend::Bucket, "bucket" }
+        })
+    {
+        LOG_INFO(g_logger, "Entropy queue: ", name);
+        benchmarkModels([backend = backend](auto& opt) { return opt.withEntropyQueueBackend(backend); });
+    }
+}
+
+void benchmarkObservationHeuristics()
+{
+    for (const auto& [heuristic, name] : std::map<ObservationHeuristic, std::string>{
+        { ObservationHeuristic::Scanline, "scanline" },
+        { ObservationHeuristic::MinimumRemainingValues, "minimum remaining values" },
+        { ObservationHeuristic::Entropy, "entropy" },
+        { ObservationHeuristic::FrontierGrowth, "frontier growth" }
+        })
+    {
+        LOG_INFO(g_logger, "Observation heuristic: ", name);
+        benchmarkModels([heuristic = heuristic](auto& opt) { return opt.withObservationHeuristic(heuristic); });
+    }
+}
+
 int main()
 {
+    //benchmarkEntropyQueues();
+    //benchmarkObservationHeuristics();
+    //return 0;
+
     //testQueue();
     //return 0;
 
+    //return checkEnginesAgree() ? 0 : 1;
+
     {
         auto t = generateAndSaveExamples();
         LOG_INFO(g_logger, "Total Time: ", elapsedSeconds(t));